@@ -71,5 +71,35 @@ int main()
 		assert(b == buf + 6);
 		assert(memcmp(buf, buf_exp, 6) == 0);
 	}
+	{
+		/* bitset_hash */
+		bitset *a = bitset_alloca(70);
+		bitset *b = bitset_alloca(70);
+		assert(bitset_hash(a) == bitset_hash(b));
+		bitset_insert(a, 3);
+		bitset_insert(a, 69);
+		bitset_insert(b, 69);
+		assert(bitset_hash(a) != bitset_hash(b));
+		bitset_insert(b, 3);
+		assert(bitset_hash(a) == bitset_hash(b));
+	}
+	{
+		/* bitset_resize */
+		bitset *a = bitset_new(10);
+		bitset_insert(a, 2);
+		bitset_insert(a, 9);
+		a = bitset_resize(a, 100);
+		assert(a->nbits == 100);
+		assert(bitset_count(a) == 2);
+		assert(bitset_contains(a, 2));
+		assert(bitset_contains(a, 9));
+		assert(!bitset_contains(a, 40));
+		bitset_insert(a, 99);
+		a = bitset_resize(a, 5);
+		assert(a->nbits == 5);
+		assert(bitset_count(a) == 1);
+		assert(bitset_contains(a, 2));
+		bitset_free(a);
+	}
 	return 0;
 }
@@ -11,6 +11,20 @@ bitset_new(unsigned nbits) {
 	return _bitset_init(malloc(_bitset_size(nbits)), nbits);
 }
 
+bitset *
+bitset_resize(bitset *a, unsigned nbits) {
+	unsigned i, oldnelem = _bitset_nelem(a->nbits);
+
+	a = realloc(a, _bitset_size(nbits));
+	for (i = oldnelem; i < _bitset_nelem(nbits); ++i)
+		a->bits[i] = 0;
+	if (nbits < a->nbits && _bitset_shift(nbits))
+		a->bits[_bitset_index(nbits)] &=
+			_bitset_bit(_bitset_shift(nbits)) - 1;
+	a->nbits = nbits;
+	return a;
+}
+
 void
 bitset_free(bitset *a) {
         free(a);
@@ -78,3 +92,20 @@ bitset_count(const bitset *s)
 		count += count_el(s, i);
 	return count;
 }
+
+unsigned
+bitset_hash(const bitset *s)
+{
+	unsigned h = 2166136261u;
+	unsigned i;
+
+	for (i = 0; i < _bitset_nelem(s->nbits); ++i)
+		h = (h ^ s->bits[i]) * 16777619u;
+	/* Each bit of h only depends on the bits at or below it in the
+	 * words, so fold the high bits down for tables indexed by the
+	 * low bits */
+	h ^= h >> 16;
+	h *= 0x45d9f3bu;
+	h ^= h >> 16;
+	return h;
+}
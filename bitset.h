@@ -58,6 +58,13 @@ bitset *bitset_dup(const bitset *a);
 /** (Initializes dup with a copy of a) */
 bitset *_bitset_init_dup(bitset *dup, const bitset *a);
 
+/**
+ * Changes the capacity of a bitset allocated with bitset_new().
+ * Members below the new capacity are retained; new bits are clear.
+ * @returns the reallocated bitset
+ */
+bitset *bitset_resize(bitset *a, unsigned nbits);
+
 /** Releases a bitset allocated with bitset_new() */
 void bitset_free(bitset *a);
 
@@ -139,4 +146,7 @@ unsigned _bitset_next(const bitset *s, unsigned i);
 /** Counts the number of elements in the bitset. */
 unsigned bitset_count(const bitset *s);
 
+/** Computes a hash of the set's members, for use in hash tables. */
+unsigned bitset_hash(const bitset *s);
+
 #endif /* bitset_h */
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "cclass.h"
+
+/* Benchmark for cclass membership tests */
+
+#define NTESTS	10000000	/* membership tests per cclass */
+
+/* Returns the current time in seconds */
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Times #cclass_contains_ch() over a stream of characters.
+ *
+ * @param name   the name of the cclass, to print
+ * @param cc     the cclass to test
+ * @param range  the tested characters are in [0,range)
+ */
+static void
+bench_contains(const char *name, const cclass *cc, unsigned range)
+{
+	unsigned i, seed = 1, count = 0;
+	double t;
+
+	t = now();
+	for (i = 0; i < NTESTS; ++i) {
+		seed = seed * 1103515245 + 12345;
+		count += cclass_contains_ch(cc, (seed >> 8) % range);
+	}
+	t = now() - t;
+	printf("%-10s %-16s %10.3f ns/test (%u%% hits)\n", name,
+		range > CCLASS_ASCII ? "contains_ch" : "contains_ch ascii",
+		t / NTESTS * 1e9, count / (NTESTS / 100));
+}
+
+int
+main()
+{
+	cclass *notslash = cclass_new();
+	cclass *many = cclass_new();
+	unsigned i;
+
+	/* [^/] */
+	cclass_add(notslash, '/', '/' + 1);
+	cclass_invert(notslash);
+
+	/* a union of many [...] terms, in ASCII and beyond */
+	for (i = 0; i < 64; ++i)
+		cclass_add(many, 'A' + i, 'A' + i + 1 + (i & 1) * 2);
+	for (i = 0; i < 256; ++i)
+		cclass_add(many, 0x100 + 16 * i, 0x100 + 16 * i + 5);
+
+	bench_contains("[^/]", notslash, CCLASS_ASCII);
+	bench_contains("[^/]", notslash, 0x1100);
+	bench_contains("many", many, CCLASS_ASCII);
+	bench_contains("many", many, 0x1100);
+
+	cclass_free(many);
+	cclass_free(notslash);
+	return 0;
+}
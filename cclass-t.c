@@ -370,6 +370,139 @@ main()
 
 		cclass_free(c1);
 	}
+	{
+		/* The ASCII bitmap and binary search agree with a
+		 * plain membership array, across splits and inversion */
+		static char member[2][300];
+		unsigned seed = 1, round, i, ch;
+
+		for (round = 0; round < 200; ++round) {
+			cclass *cc[2];
+			int expect;
+
+			for (i = 0; i < 2; ++i) {
+				unsigned n;
+				cc[i] = cclass_new();
+				memset(member[i], 0, sizeof member[i]);
+				for (n = 0; n < round % 12; ++n) {
+					unsigned lo, hi;
+					seed = seed * 1103515245 + 12345;
+					lo = (seed >> 16) % 290;
+					hi = lo + 1 + (seed >> 8) % 9;
+					cclass_add(cc[i], lo, hi);
+					memset(&member[i][lo], 1, hi - lo);
+				}
+			}
+			if (round % 3 == 1) {
+				cclass_invert(cc[1]);
+				for (ch = 0; ch < 300; ++ch)
+					member[1][ch] = !member[1][ch];
+			}
+			if (round % 3 == 2 && cc[1]->nintervals &&
+			    cc[1]->interval[0].lo < 120 &&
+			    cclass_contains_ch(cc[1], 120) &&
+			    !cclass_contains_ch(cc[1], 119))
+			{
+				/* split off everything from 120 */
+				cclass_free(cclass_split(cc[1], 120));
+				memset(&member[1][120], 0, 300 - 120);
+			}
+			expect = 0;
+			for (ch = 0; ch < 300; ++ch) {
+				assert(cclass_contains_ch(cc[0], ch) ==
+				       member[0][ch]);
+				assert(cclass_contains_ch(cc[1], ch) ==
+				       member[1][ch]);
+				assert(cclass_contains(cc[0], ch, ch + 1) ==
+				       member[0][ch]);
+				if (member[0][ch] && member[1][ch])
+					expect = 1;
+			}
+			assert(cclass_intersects(cc[0], cc[1]) == expect);
+			assert(cclass_intersects(cc[1], cc[0]) == expect);
+			cclass_free(cc[0]);
+			cclass_free(cc[1]);
+		}
+	}
+	{
+		/* cclass_intern */
+		cclass *a = cclass_intern(make_cclass("a-cx"));
+		cclass *b = cclass_intern(make_cclass("a-cx"));
+		cclass *c = cclass_intern(make_cclass("a-c"));
+		cclass *d;
+
+		assert(a == b);
+		assert(a->refs == 2);
+		assert(a != c);
+		assert(cclass_eq(a, b));
+		assert(!cclass_eq(a, c));
+		assert(cclass_intern(a) == a);
+		assert(a->refs == 2);
+		cclass_free(b);
+		assert(a->refs == 1);
+		assert(cclass_eqstr(a, "a-cx"));
+		assert(cclass_contains_ch(a, 'x'));
+
+		/* a mutable copy is not interned */
+		d = cclass_dup(a);
+		assert(d->refs == 0);
+		cclass_add(d, 'y', 'z' + 1);
+		assert(cclass_eqstr(a, "a-cx"));
+		d = cclass_intern(d);
+		assert(d != a);
+
+		cclass_free(a);
+		cclass_free(c);
+		/* a is gone, so a new one is interned afresh */
+		a = cclass_intern(make_cclass("a-cx"));
+		assert(a->refs == 1);
+		cclass_free(a);
+		cclass_free(d);
+	}
+	{
+		/* cclass_builder against cclass_add */
+		struct cclass_builder b;
+		unsigned seed = 2, round, k;
+		cclass *cc;
+
+		cclass_builder_init(&b);
+		cc = cclass_builder_finish(&b);
+		assert(cc->nintervals == 0);
+		cclass_free(cc);
+
+		for (round = 0; round < 500; ++round) {
+			cclass *expect = cclass_new();
+			unsigned n = round % 40;
+
+			for (k = 0; k < n; ++k) {
+				unsigned lo, hi;
+				seed = seed * 1103515245 + 12345;
+				if (round % 2) {
+					/* abutting, often repeated */
+					lo = 10 * ((seed >> 16) % 30);
+					hi = lo + 10;
+				} else {
+					lo = (seed >> 16) % 300;
+					hi = lo + (seed >> 8) % 20;
+				}
+				cclass_builder_add(&b, lo, hi);
+				cclass_add(expect, lo, hi);
+			}
+			cc = cclass_builder_finish(&b);
+			assert(b.n == 0);
+			assert(cclass_eq(cc, expect));
+			for (k = 0; k < 330; ++k)
+				assert(cclass_contains_ch(cc, k) ==
+				       cclass_contains_ch(expect, k));
+			/* the result is mutable */
+			cclass_add(cc, 400, 401);
+			cclass_add(expect, 400, 401);
+			assert(cclass_eq(cc, expect));
+			cclass_free(cc);
+			cclass_free(expect);
+		}
+		cclass_builder_fini(&b);
+	}
 	/*
 	 *  [a,b),[x,y)   -> [0,a),[b,x),[y,MAX)
 	 *  [0,b),[x,y)   ->       [b,x),[y,MAX)
@@ -10,12 +10,162 @@ asm(".pushsection \".debug_gdb_scripts\", \"MS\",@progbits,1\n"
     ".asciz \"cclass-gdb.py\"\n"
     ".popsection\n");
 
+/** Adds the characters of [lo,hi) below #CCLASS_ASCII to the bitmap */
+static void
+ascii_add(cclass *cc, unsigned lo, unsigned hi)
+{
+	if (hi > CCLASS_ASCII)
+		hi = CCLASS_ASCII;
+	for (; lo < hi; ++lo)
+		cc->ascii[lo / 32] |= 1u << (lo % 32);
+}
+
+/** Recomputes the bitmap from the intervals */
+static void
+ascii_update(cclass *cc)
+{
+	unsigned i;
+
+	memset(cc->ascii, 0, sizeof cc->ascii);
+	for (i = 0; i < cc->nintervals &&
+		    cc->interval[i].lo < CCLASS_ASCII; ++i)
+		ascii_add(cc, cc->interval[i].lo, cc->interval[i].hi);
+}
+
+/**
+ * Finds the first interval that ends after ch, by binary search.
+ * @returns the index of the interval, or nintervals if none
+ */
+static unsigned
+cclass_find(const cclass *cc, unsigned ch)
+{
+	unsigned lo = 0, hi = cc->nintervals;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (cc->interval[mid].hi <= ch)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 cclass *
 cclass_new()
 {
 	cclass *cc = malloc(sizeof *cc);
 	cc->nintervals = 0;
 	cc->interval = 0;
+	memset(cc->ascii, 0, sizeof cc->ascii);
+	cc->refs = 0;
+	return cc;
+}
+
+/*
+ * The intern table: an open-addressed hash set of the interned
+ * cclasses.
+ */
+static struct {
+	unsigned size;		/* (a power of 2) */
+	unsigned count;
+	cclass **slot;		/* NULL when empty */
+} interned;
+
+/* Hashes the intervals of a cclass */
+static unsigned
+cclass_hash(const cclass *cc)
+{
+	unsigned h = 2166136261u;
+	unsigned i;
+
+	for (i = 0; i < cc->nintervals; ++i) {
+		h = (h ^ cc->interval[i].lo) * 16777619u;
+		h = (h ^ cc->interval[i].hi) * 16777619u;
+	}
+	return h;
+}
+
+/* Inserts a cclass into a free slot of the intern table */
+static void
+interned_insert(cclass *cc)
+{
+	unsigned h = cclass_hash(cc);
+
+	while (interned.slot[h & (interned.size - 1)])
+		h++;
+	interned.slot[h & (interned.size - 1)] = cc;
+}
+
+/* Removes a cclass from the intern table */
+static void
+interned_remove(const cclass *cc)
+{
+	unsigned i = cclass_hash(cc) & (interned.size - 1);
+
+	while (interned.slot[i] != cc)
+		i = (i + 1) & (interned.size - 1);
+	interned.slot[i] = 0;
+	interned.count--;
+
+	/* Reinsert the rest of the cluster, so that probes
+	 * are not cut short by the new hole */
+	for (i = (i + 1) & (interned.size - 1); interned.slot[i];
+	     i = (i + 1) & (interned.size - 1))
+	{
+		cclass *moved = interned.slot[i];
+		interned.slot[i] = 0;
+		interned_insert(moved);
+	}
+	if (!interned.count) {
+		free(interned.slot);
+		interned.slot = 0;
+		interned.size = 0;
+	}
+}
+
+cclass *
+cclass_intern(cclass *cc)
+{
+	unsigned h, i;
+	cclass *found;
+
+	if (cc->refs)
+		return cc;
+	if (2 * (interned.count + 1) > interned.size) {
+		cclass **old = interned.slot;
+		unsigned oldsize = interned.size;
+
+		interned.size = oldsize ? 2 * oldsize : 64;
+		interned.slot = calloc(interned.size, sizeof *interned.slot);
+		for (i = 0; i < oldsize; ++i)
+			if (old[i])
+				interned_insert(old[i]);
+		free(old);
+	}
+	h = cclass_hash(cc);
+	while ((found = interned.slot[h & (interned.size - 1)])) {
+		if (cclass_eq(found, cc)) {
+			cclass_free(cc);
+			return cclass_ref(found);
+		}
+		h++;
+	}
+
+	/* Trim the spare capacity, as it will never be used */
+	if (cc->nintervals)
+		cc->interval = realloc(cc->interval,
+			cc->nintervals * sizeof *cc->interval);
+	cc->refs = 1;
+	interned.slot[h & (interned.size - 1)] = cc;
+	interned.count++;
+	return cc;
+}
+
+cclass *
+cclass_ref(cclass *cc)
+{
+	cc->refs++;
 	return cc;
 }
 
@@ -23,6 +173,11 @@ void
 cclass_free(cclass *cc)
 {
 	if (cc) {
+		if (cc->refs) {
+			if (--cc->refs)
+				return;
+			interned_remove(cc);
+		}
 		free(cc->interval);
 		free(cc);
 	}
@@ -39,6 +194,7 @@ cclass_dup(const cclass *cc)
 			sizeof cc->interval[0]);
 		memcpy(dup->interval, cc->interval,
 			sizeof dup->interval[0] * dup->nintervals);
+		memcpy(dup->ascii, cc->ascii, sizeof dup->ascii);
 	}
 	return dup;
 }
@@ -87,8 +243,10 @@ cclass_add(cclass *cc, unsigned lo, unsigned hi)
 {
 	unsigned i;
 
+	assert(!cc->refs);	/* interned cclasses are immutable */
 	if (lo >= hi)
 		return;
+	ascii_add(cc, lo, hi);
 
 	/* skip all the intervals distinctly less than the new,
 	 * [i.lo,i.hi) << [lo,hi) */
@@ -125,33 +283,31 @@ cclass_add(cclass *cc, unsigned lo, unsigned hi)
 int
 cclass_contains(const cclass *cc, unsigned lo, unsigned hi)
 {
-	unsigned i;
-	for (i = 0; i < cc->nintervals; ++i) {
-		if (lo >= cc->interval[i].lo && hi <= cc->interval[i].hi)
-			return 1;
-		if (lo < cc->interval[i].lo)
-			break;
-	}
-	return 0;
+	unsigned i = cclass_find(cc, lo);
+
+	return i < cc->nintervals &&
+	       lo >= cc->interval[i].lo && hi <= cc->interval[i].hi;
 }
 
 int
 cclass_contains_ch(const cclass *cc, unsigned ch)
 {
 	unsigned i;
-	for (i = 0; i < cc->nintervals; ++i) {
-		if (ch >= cc->interval[i].lo && ch < cc->interval[i].hi)
-			return 1;
-		if (ch < cc->interval[i].lo)
-			break;
-	}
-	return 0;
+
+	if (ch < CCLASS_ASCII)
+		return (cc->ascii[ch / 32] >> (ch % 32)) & 1;
+	i = cclass_find(cc, ch);
+	return i < cc->nintervals && ch >= cc->interval[i].lo;
 }
 
 int
 cclass_eq(const cclass *c1, const cclass *c2)
 {
 	unsigned i;
+	if (c1 == c2)
+		return 1;
+	if (c1->refs && c2->refs)
+		return 0;	/* interned, so unequal */
 	if (c1->nintervals != c2->nintervals)
 		return 0;
 	for (i = 0; i < c1->nintervals; i++)
@@ -167,10 +323,10 @@ cclass_split(cclass *cc, unsigned p)
 	cclass *upper;
 	unsigned i;
 
+	assert(!cc->refs);
+
 	/* Find the interval that contains p */
-	for (i = 0; i < cc->nintervals; ++i)
-		if (p < cc->interval[i].hi)
-			break;
+	i = cclass_find(cc, p);
 	assert(i < cc->nintervals);
 	assert(p >= cc->interval[i].lo);
 	assert(p > cc->interval[0].lo);
@@ -188,14 +344,98 @@ cclass_split(cclass *cc, unsigned p)
 		cc->interval[i].hi = p;
 		cc->nintervals = i + 1;
 	}
+	ascii_update(cc);
+	ascii_update(upper);
 	return upper;
 }
 
+void
+cclass_builder_init(struct cclass_builder *b)
+{
+	b->n = 0;
+	b->capacity = 0;
+	b->range = 0;
+}
+
+void
+cclass_builder_fini(struct cclass_builder *b)
+{
+	free(b->range);
+}
+
+void
+cclass_builder_add(struct cclass_builder *b, unsigned lo, unsigned hi)
+{
+	if (lo >= hi)
+		return;
+	if (b->n && b->range[b->n - 1].hi == lo) {
+		/* extend the previous, adjacent interval */
+		b->range[b->n - 1].hi = hi;
+		return;
+	}
+	if (b->n == b->capacity) {
+		b->capacity = b->capacity ? 2 * b->capacity : 16;
+		b->range = realloc(b->range, b->capacity * sizeof *b->range);
+	}
+	b->range[b->n].lo = lo;
+	b->range[b->n].hi = hi;
+	b->n++;
+}
+
+/* Orders ranges by their lo for qsort */
+static int
+range_cmp(const void *a, const void *b)
+{
+	const struct cclass_range *ra = a;
+	const struct cclass_range *rb = b;
+
+	return ra->lo < rb->lo ? -1 : ra->lo > rb->lo;
+}
+
+cclass *
+cclass_builder_finish(struct cclass_builder *b)
+{
+	cclass *cc = cclass_new();
+	unsigned i, j;
+
+	if (!b->n)
+		return cc;
+
+	/* Sort, unless already sorted */
+	for (i = 1; i < b->n; ++i)
+		if (b->range[i].lo < b->range[i - 1].lo)
+			break;
+	if (i < b->n)
+		qsort(b->range, b->n, sizeof *b->range, range_cmp);
+
+	/* Merge overlapping and adjacent intervals in place */
+	for (i = 1, j = 0; i < b->n; ++i) {
+		if (b->range[i].lo <= b->range[j].hi) {
+			if (b->range[i].hi > b->range[j].hi)
+				b->range[j].hi = b->range[i].hi;
+		} else
+			b->range[++j] = b->range[i];
+	}
+	cc->nintervals = j + 1;
+
+	/* (rounded up to CCINC, as cclass_insert_before expects) */
+	cc->interval = malloc((cc->nintervals + CCINC - 1) / CCINC * CCINC *
+			      sizeof *cc->interval);
+	for (i = 0; i < cc->nintervals; ++i) {
+		cc->interval[i].lo = b->range[i].lo;
+		cc->interval[i].hi = b->range[i].hi;
+	}
+	ascii_update(cc);
+	b->n = 0;
+	return cc;
+}
+
 cclass *
 cclass_invert(cclass *cc)
 {
 	unsigned i, j, lasthi, lo, hi;
 
+	assert(!cc->refs);
 	lasthi = 0;
 	for (i = j = 0; i < cc->nintervals; i++) {
 		lo = cc->interval[i].lo;
@@ -220,6 +460,7 @@ cclass_invert(cclass *cc)
 		j++;
 	}
 	cc->nintervals = j;
+	ascii_update(cc);
 	return cc;
 }
 
@@ -257,7 +498,15 @@ cclass_contains_cc(const cclass *big, const cclass *small)
 int
 cclass_intersects(const cclass *cc1, const cclass *cc2)
 {
-	unsigned i1 = 0, i2 = 0;
+	unsigned i1, i2, k;
+
+	for (k = 0; k < CCLASS_ASCII / 32; ++k)
+		if (cc1->ascii[k] & cc2->ascii[k])
+			return 1;
+
+	/* Any intersection is above the bitmap */
+	i1 = cclass_find(cc1, CCLASS_ASCII);
+	i2 = cclass_find(cc2, CCLASS_ASCII);
 	while (i1 < cc1->nintervals && i2 < cc2->nintervals) {
 		if (cc1->interval[i1].hi <= cc2->interval[i2].lo) {
 			i1++;
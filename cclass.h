@@ -3,6 +3,9 @@
 
 #define MAXCHAR 0x110000
 
+/* Characters below this are also held in the cclass's bitmap */
+#define CCLASS_ASCII 128
+
 /**
  * A character class is a sorted set of character ranges. For example,
  *   {[a,d),[g,k)} === {a,b,c, g,h,i,j}
@@ -11,6 +14,12 @@
  * Characters are assumed to be Unicode code points up to #MAXCHAR.
  * The @c NULL cclass is called ε (epsilon).
  * The empty cclass [] matches no characters.
+ * The ASCII members are duplicated in a bitmap, so that they can be
+ * tested without searching the intervals.
+ *
+ * A cclass can be interned with #cclass_intern(), after which it is
+ * immutable and shared by reference count. Equal interned cclasses
+ * are the same pointer.
  */
 typedef struct cclass {
 	unsigned nintervals;
@@ -18,10 +27,38 @@ typedef struct cclass {
 		unsigned lo;	/**< first character in interval */
 		unsigned hi;	/**< first character not in interval */
 	} *interval;
+	unsigned ascii[CCLASS_ASCII / 32]; /**< bitmap of members < 128 */
+	unsigned refs;		/**< references, or 0 if not interned */
 } cclass;
 
 cclass * cclass_new(void);
+
+/**
+ * Releases a cclass.
+ * For an interned cclass, this releases one reference to it.
+ */
 void	 cclass_free(cclass *cc);
+
+/**
+ * Interns a cclass.
+ * If an equal cclass has already been interned, @a cc is released
+ * and a new reference to the equal cclass is returned instead.
+ * The returned cclass must not be modified, and each reference
+ * must be released with #cclass_free().
+ *
+ * @param cc  the cclass to intern; it may already be interned
+ *
+ * @returns the interned cclass
+ */
+cclass * cclass_intern(cclass *cc);
+
+/**
+ * Adds a reference to an interned cclass.
+ * @returns @a cc
+ */
+cclass * cclass_ref(cclass *cc);
+
+/** Returns a mutable copy of a cclass, even if interned. */
 cclass * cclass_dup(const cclass *cc);
 int	 cclass_is_empty(const cclass *cc);
 
@@ -64,6 +101,35 @@ int	 cclass_eq(const cclass *c1, const cclass *c2);
  */
 cclass *cclass_split(cclass *cc, unsigned p);
 
+/**
+ * A builder collects intervals in any order, and then constructs
+ * a cclass from them in one sort-and-merge step.
+ * This is faster than repeated #cclass_add() for many intervals.
+ */
+struct cclass_builder {
+	unsigned n, capacity;
+	struct cclass_range {
+		unsigned lo, hi;
+	} *range;
+};
+
+/** Initializes an empty cclass builder. */
+void	 cclass_builder_init(struct cclass_builder *b);
+
+/** Releases the storage of a cclass builder. */
+void	 cclass_builder_fini(struct cclass_builder *b);
+
+/** Adds the interval [lo,hi) to the builder. */
+void	 cclass_builder_add(struct cclass_builder *b, unsigned lo, unsigned hi);
+
+/**
+ * Constructs a cclass from the intervals collected, and empties
+ * the builder so that it can be reused.
+ *
+ * @returns a new cclass that is the union of the intervals added
+ */
+cclass * cclass_builder_finish(struct cclass_builder *b);
+
 /**
  * Inverts a cclass, in-place.
  * The inverse of [] is [0,MAXCHAR).
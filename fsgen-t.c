@@ -1,6 +1,14 @@
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "match.h"
 #include "str.h"
+#include "globs.h"
 #include "fsgen.h"
 
 /* Unit tests for the filesystem generator implementation */
@@ -63,9 +71,130 @@ matches_free(struct match **mp)
 	}
 }
 
+/** Removes a directory tree, opening each directory by its parent */
+static void
+rm_tree(int parent, const char *name)
+{
+	int fd = openat(parent, name, O_RDONLY | O_DIRECTORY);
+	DIR *dir = fdopendir(fd);
+	struct dirent *de;
+
+	assert(dir);
+	while ((de = readdir(dir))) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+		if (de->d_type == DT_DIR)
+			rm_tree(fd, de->d_name);
+		else
+			assert(unlinkat(fd, de->d_name, 0) == 0);
+	}
+	closedir(dir);
+	assert(unlinkat(parent, name, AT_REMOVEDIR) == 0);
+}
+
+/* A directory chain whose path is longer than PATH_MAX */
+#define DEEP_NAME	"directory.name.xyz"
+#define DEEP_LEVELS	300
+
 int
 main()
 {
+	{
+		/* A generator with state opens each directory relative
+		 * to its parent, so there is no limit on path length */
+		char tmpdir[] = "/tmp/fsgen-t.XXXXXX";
+		struct fsgen *fsgen = fsgen_new();
+		struct match *matches, **mp;
+		const struct match *m;
+		int cwd, fd, sub, i;
+		str *prefix = 0;
+
+		assert(mkdtemp(tmpdir));
+		cwd = open(".", O_RDONLY | O_DIRECTORY);
+		assert(chdir(tmpdir) == 0);
+		fd = open(".", O_RDONLY | O_DIRECTORY);
+		for (i = 0; i < DEEP_LEVELS; i++) {
+			assert(mkdirat(fd, DEEP_NAME, 0777) == 0);
+			sub = openat(fd, DEEP_NAME, O_RDONLY | O_DIRECTORY);
+			close(fd);
+			fd = sub;
+		}
+		close(openat(fd, "file", O_WRONLY | O_CREAT, 0666));
+		close(fd);
+
+		for (i = 0; i <= DEEP_LEVELS; i++) {
+			str *next;
+
+			mp = fs_generator.generate(&matches, prefix, fsgen);
+			*mp = 0;
+			if (i == DEEP_LEVELS) {
+				assert(mfind_undef(matches, "file"));
+			} else {
+				m = mfind_def(matches, DEEP_NAME "/");
+				assert(m);
+				next = str_cat(prefix, m->str);
+				str_free(prefix);
+				prefix = next;
+			}
+			matches_free(&matches);
+		}
+		assert(str_len(prefix) > 4096);
+		str_free(prefix);
+		fs_generator.free(fsgen);
+
+		rm_tree(AT_FDCWD, DEEP_NAME);
+		assert(fchdir(cwd) == 0);
+		close(cwd);
+		assert(rmdir(tmpdir) == 0);
+	}
+	{
+		/* Without state, the generator can be called from
+		 * several worker threads at once */
+		char tmpdir[] = "/tmp/fsgen-t.XXXXXX";
+		char path[32];
+		struct globs *globs = globs_new();
+		struct matcher *matcher;
+		STR glob = str_new("d*/e*/f");
+		unsigned i, j, n = 0;
+		int cwd;
+		str *s;
+
+		assert(mkdtemp(tmpdir));
+		cwd = open(".", O_RDONLY | O_DIRECTORY);
+		assert(chdir(tmpdir) == 0);
+		for (i = 0; i < 8; i++) {
+			snprintf(path, sizeof path, "d%u", i);
+			assert(mkdir(path, 0777) == 0);
+			for (j = 0; j < 8; j++) {
+				snprintf(path, sizeof path, "d%u/e%u", i, j);
+				assert(mkdir(path, 0777) == 0);
+				snprintf(path, sizeof path, "d%u/e%u/f", i, j);
+				close(open(path, O_WRONLY | O_CREAT, 0666));
+			}
+		}
+
+		globs_add(globs, glob, "f");
+		globs_compile(globs);
+		matcher = matcher_new(globs, &fs_generator, 0);
+		matcher_set_threads(matcher, 4);
+		while ((s = matcher_next(matcher, 0))) {
+			assert(str_len(s) == 7);
+			n++;
+			str_free(s);
+		}
+		matcher_free(matcher);
+		globs_free(globs);
+		assert(n == 64);
+
+		for (i = 0; i < 8; i++) {
+			snprintf(path, sizeof path, "d%u", i);
+			rm_tree(AT_FDCWD, path);
+		}
+		assert(fchdir(cwd) == 0);
+		close(cwd);
+		assert(rmdir(tmpdir) == 0);
+	}
 	{
 		struct match *matches, **mp;
 
@@ -77,6 +206,8 @@ main()
 		assert(mfind_def(matches, "./"));
 		assert(mfind_undef(matches, "."));
 
+		/* The generated strings omit the prefix */
+
 		/*
 		 * NOTE: These tests assumes the filesystem actually
 		 * contains the file /bin/rm
@@ -86,15 +217,16 @@ main()
 		root = mfind_def(matches, "/");
 		mp = fs_generate(&root_matches, root->str);
 		*mp = 0;
-		assert(mfind_def(root_matches, "/bin/"));
-		assert(mfind_undef(root_matches, "/bin"));
+		assert(mfind_def(root_matches, "bin/"));
+		assert(mfind_undef(root_matches, "bin"));
 
 		struct match *bin_matches;
 		const struct match *bin;
-		bin = mfind_def(root_matches, "/bin/");
-		mp = fs_generate(&bin_matches, bin->str);
+		bin = mfind_def(root_matches, "bin/");
+		STR binpath = str_cat(root->str, bin->str);
+		mp = fs_generate(&bin_matches, binpath);
 		*mp = 0;
-		assert(mfind_undef(bin_matches, "/bin/rm"));
+		assert(mfind_undef(bin_matches, "rm"));
 
 		matches_free(&bin_matches);
 		matches_free(&root_matches);
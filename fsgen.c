@@ -1,63 +1,219 @@
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "str.h"
-#include "atom.h"
+#include "vector.h"
 #include "match.h"
 #include "fsgen.h"
 
-#define PATHMAX 4096
+/* Most directories an fsgen keeps open; the deepest are kept */
+#define FSGEN_MAXOPEN	64
+
+/* An open directory, and the prefix that names it */
+struct fsgen_dir {
+	char *path;		/* ends with '/' */
+	unsigned len;
+	DIR *dir;
+};
+
+/*
+ * The directories on the path to the last one expanded are kept open,
+ * so that a directory under them is opened relative to the nearest.
+ * A depth first walk resolves only one path component per directory.
+ */
+struct fsgen {
+	VECTOR_OF(struct fsgen_dir) open;
+};
+
+struct fsgen *
+fsgen_new()
+{
+	return calloc(1, sizeof (struct fsgen));
+}
+
+/* Closes the most recently opened directory */
+static void
+fsgen_pop(struct fsgen *fsgen)
+{
+	struct fsgen_dir *d = &vector_at(fsgen->open, --fsgen->open.len);
+
+	closedir(d->dir);
+	free(d->path);
+}
+
+void
+fsgen_free(struct fsgen *fsgen)
+{
+	if (!fsgen)
+		return;
+	while (fsgen->open.len)
+		fsgen_pop(fsgen);
+	vector_free(&fsgen->open);
+	free(fsgen);
+}
+
+/*
+ * Appends a match for each entry of an open directory.
+ * Every directory entry is returned, including . and ..
+ * Each string is a fresh segment, so that workers can share none.
+ */
+static struct match **
+fs_readdir(struct match **mp, DIR *dir)
+{
+	char name[sizeof ((struct dirent *)0)->d_name + 1];
+	struct dirent *de;
+	struct match *m;
+	struct stat st;
+
+	while ((de = readdir(dir))) {
+		int isdir;
+
+		if (!de->d_name[0])
+			continue;
+		m = match_new(str_new(de->d_name));
+		*mp = m; mp = &m->next;
+
+		isdir = de->d_type == DT_DIR;
+		if (de->d_type == DT_UNKNOWN)
+			isdir = fstatat(dirfd(dir), de->d_name, &st,
+					AT_SYMLINK_NOFOLLOW) == 0 &&
+				S_ISDIR(st.st_mode);
+
+		/* Directories have the / appended */
+		if (isdir) {
+			unsigned len = strlen(de->d_name);
+
+			memcpy(name, de->d_name, len);
+			name[len] = '/';
+			m = match_new(str_newn(name, len + 1));
+			m->flags |= MATCH_DEFERRED;
+			*mp = m; mp = &m->next;
+		}
+	}
+	return mp;
+}
+
+/* Adds the root entry, / */
+static struct match **
+fs_root(struct match **mp)
+{
+	struct match *m = match_new(str_new("/"));
+
+	m->flags |= MATCH_DEFERRED;
+	*mp = m;
+	return &m->next;
+}
+
+/* Copies a prefix into a new NUL-terminated buffer */
+static char *
+prefix_path(const str *prefix, unsigned *lenp)
+{
+	unsigned len = str_len(prefix);
+	char *path = malloc(len + 1);
+
+	str_copy(prefix, path, 0, len);
+	path[len] = '\0';
+	*lenp = len;
+	return path;
+}
 
 struct match **
 fs_generate(struct match **mp, const str *prefix)
 {
-	char path[PATHMAX];
 	DIR *dir;
-	struct match *m;
-	atom slash = atom_s("/");
+	char *path;
+	unsigned len;
 
 	if (!prefix) {
-		/* Add the root entry, / */
-		m = match_new(atom_to_str(slash));
-		m->flags |= MATCH_DEFERRED;
-		*mp = m;
-		mp = &m->next;
-
-		/* And return the bare content of . */
-		path[0] = '.';
-		path[1] = '\0';
+		/* The root, and the bare content of . */
+		mp = fs_root(mp);
+		dir = opendir(".");
 	} else {
-		unsigned pathlen = str_copy(prefix, path, 0, PATHMAX - 1);
-		path[pathlen] = '\0';
+		path = prefix_path(prefix, &len);
+		dir = opendir(path);
+		free(path);
 	}
-	dir = opendir(path);
 	if (dir) {
-		/* Every directory entry is returned,
-		 * including . and .. */
-		struct dirent *de;
-		while ((de = readdir(dir))) {
-			if (!de->d_name[0])
-				continue;
-			str *s, **x;
-			x = &s;
-			x = str_xcat(x, prefix);
-			x = str_xcats(x, de->d_name);
-			*x = 0;
-			m = match_new(s);
-			*mp = m; mp = &m->next;
+		mp = fs_readdir(mp, dir);
+		closedir(dir);
+	}
+	return mp;
+}
 
-			/* Directories have the / appended */
-			if (de->d_type == DT_DIR) {
-				str *ss;
-				x = &ss;
-				x = str_xcat(x, s);
-				*x = atom_to_str(slash);
-				m = match_new(ss);
-				m->flags |= MATCH_DEFERRED;
-				*mp = m; mp = &m->next;
-			}
-		}
+static struct match **
+fsgen_generate(struct match **mp, const str *prefix, void *gcontext)
+{
+	struct fsgen *fsgen = gcontext;
+	const struct fsgen_dir *top;
+	int fd, base = AT_FDCWD;
+	const char *rel;
+	char *path;
+	unsigned len;
+	DIR *dir;
+
+	if (!fsgen)
+		return fs_generate(mp, prefix);
+	if (!prefix) {
+		mp = fs_root(mp);
+		path = strdup(".");
+		len = 0;
+	} else
+		path = prefix_path(prefix, &len);
+
+	/* Close the directories that are not above this one */
+	while (fsgen->open.len) {
+		top = &vector_at(fsgen->open, fsgen->open.len - 1);
+		if (top->len < len && memcmp(top->path, path, top->len) == 0)
+			break;
+		fsgen_pop(fsgen);
+	}
+	rel = path;
+	if (fsgen->open.len) {
+		top = &vector_at(fsgen->open, fsgen->open.len - 1);
+		base = dirfd(top->dir);
+		rel = path + top->len;
+	}
+
+	fd = openat(base, rel, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1 || !(dir = fdopendir(fd))) {
+		if (fd != -1)
+			close(fd);
+		free(path);
+		return mp;
+	}
+	mp = fs_readdir(mp, dir);
+
+	if (!len) {
 		closedir(dir);
+		free(path);
+		return mp;
+	}
+
+	/* Keep it open for the directories under it,
+	 * closing the shallowest directory if too many are open */
+	if (fsgen->open.len == FSGEN_MAXOPEN) {
+		struct fsgen_dir *d = &vector_at(fsgen->open, 0);
+		closedir(d->dir);
+		free(d->path);
+		memmove(d, d + 1, --fsgen->open.len * sizeof *d);
 	}
+	struct fsgen_dir d = { path, len, dir };
+	vector_append(fsgen->open, d);
 	return mp;
 }
+
+static void
+fsgen_generator_free(void *gcontext)
+{
+	fsgen_free(gcontext);
+}
+
+const struct generator fs_generator = {
+	.generate = fsgen_generate,
+	.free = fsgen_generator_free,
+};
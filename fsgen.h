@@ -3,11 +3,16 @@
 
 struct match;
 struct str;
+struct generator;
 
 /**
  * Generates candidate match objects from the filesystem.
  * The initial blank prefix expands to the content of the
  * current directory, plus /.
+ * Each match holds only the entry's name, with a / appended
+ * for a directory; the matcher joins it to the prefix.
+ * It may be called from several threads at once, and the strings
+ * it generates share no segments.
  *
  * @param mp      pointer to storage to hold the resulting
  *                match list
@@ -19,4 +24,33 @@ struct str;
  */
 struct match **fs_generate(struct match **mp, const struct str *prefix);
 
+/*
+ * A filesystem generator's state. It keeps the directories on the
+ * path to the last one expanded open, and opens each directory with
+ * openat() relative to the nearest of them. When the matcher walks
+ * the tree depth first, each directory is then found by looking up
+ * one path component, however deep it is.
+ */
+struct fsgen;
+
+/**
+ * Allocates the state for a filesystem generator.
+ * @returns the state, to be released with #fsgen_free()
+ */
+struct fsgen *fsgen_new(void);
+
+/**
+ * Releases the state of a filesystem generator, closing its directories.
+ * @param fsgen  the state, or @c NULL
+ */
+void fsgen_free(struct fsgen *fsgen);
+
+/**
+ * The filesystem generator. Its context is a #fsgen, which its free
+ * function releases, or @c NULL to call #fs_generate() instead.
+ * A #fsgen must not be used by several threads at once; for worker
+ * threads, use a @c NULL context.
+ */
+extern const struct generator fs_generator;
+
 #endif /* fsgen_h */
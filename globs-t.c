@@ -2,10 +2,15 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "globs.h"
 #include "str.h"
+#include "cclass.h"
 #include "nfa-dbg.h"
 
 /* Unit tests for glob patterns */
@@ -88,6 +93,95 @@ assert_match_(const char *file, int lineno, int expect_accept,
 	globs_free(g);
 }
 
+/**
+ * Asserts that states of two glob sets with the same globs accept
+ * the same ref, and have the same dead/more flags and suffix.
+ */
+static void
+assert_same_state(const struct globs *g, unsigned state,
+		  const struct globs *gi, unsigned statei)
+{
+	const unsigned mask = GLOBS_STATE_DEAD | GLOBS_STATE_MORE;
+	char buf[GLOBS_SUFFIX_MAX], bufi[GLOBS_SUFFIX_MAX];
+	unsigned n, ni;
+
+	assert(globs_is_accept_state(g, state) ==
+	       globs_is_accept_state(gi, statei));
+	assert((globs_state_flags(g, state) & mask) ==
+	       (globs_state_flags(gi, statei) & mask));
+	n = globs_state_suffix(g, state, buf);
+	ni = globs_state_suffix(gi, statei, bufi);
+	assert(n == ni && memcmp(buf, bufi, n) == 0);
+}
+
+/**
+ * Times adding globs to a compiled set of n globs.
+ * @returns the least time for one add, in seconds
+ */
+static double
+add_time(unsigned n, unsigned flags)
+{
+	double best = 0;
+	unsigned r, i;
+	char buf[32];
+
+	for (r = 0; r < 3; ++r) {
+		struct globs *g = globs_new();
+		struct timespec t0, t1;
+		double t;
+
+		for (i = 0; i < n + 33; ++i) {
+			str *s;
+			snprintf(buf, sizeof buf, "net%u/*@up", i);
+			s = str_new(buf);
+			if (i == n + 1)
+				clock_gettime(CLOCK_MONOTONIC, &t0);
+			globs_add(g, s, (void *)(long)(i + 1));
+			str_free(s);
+			if (i == n - 1)
+				globs_compile_flags(g, flags);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		t = (t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) * 1e-9)
+		    / 32;
+		if (!r || t < best)
+			best = t;
+		globs_free(g);
+	}
+	return best;
+}
+
+/**
+ * Asserts that stepping a string with #globs_step_utf8() through
+ * byte-compiled globs has the same effect as decoding the string and
+ * stepping its characters through the character automaton.
+ *
+ * @param g   globs compiled without #GLOBS_BYTES
+ * @param gb  the same globs compiled with #GLOBS_BYTES
+ * @param s   the test string (may contain invalid UTF-8)
+ */
+static void
+assert_utf8_equiv(const struct globs *g, const struct globs *gb,
+		  const char *s, unsigned len)
+{
+	STR str = str_newn(s, len);
+	stri i = stri_str(str);
+	stri ib = stri_str(str);
+	unsigned state = 0, stateb = 0;
+
+	while (stri_more(i)) {
+		int ok = globs_step(g, stri_utf8_inc(&i), &state);
+		int okb = globs_step_utf8(gb, &ib, &stateb);
+		assert(ok == okb);
+		assert(i.str == ib.str && i.pos == ib.pos);
+		if (!ok)
+			return;
+		assert(!globs_is_accept_state(g, state) ==
+		       !globs_is_accept_state(gb, stateb));
+	}
+	assert(!stri_more(ib));
+}
+
 int
 main()
 {
@@ -132,11 +226,419 @@ main()
 		assert(globs_is_accept_state(g, state) == refA);
 		globs_free(g);
 	}
+	{
+		/* Multiple globs in the one set */
+		const void * const refB = "B";
+		STR a = str_new("a*");
+		STR b = str_new("*b");
+		struct globs *g = globs_new();
+		unsigned state;
+		globs_add(g, a, refA);
+		globs_add(g, b, refB);
+		globs_compile(g);
+		state = 0;
+		assert(globs_step(g, 'a', &state));
+		assert(globs_is_accept_state(g, state) == refA);
+		state = 0;
+		assert(globs_step(g, 'x', &state));
+		assert(!globs_is_accept_state(g, state));
+		assert(globs_step(g, 'b', &state));
+		assert(globs_is_accept_state(g, state) == refB);
+		state = 0;
+		assert(globs_step(g, 'b', &state));
+		assert(globs_is_accept_state(g, state) == refB);
+		globs_free(g);
+	}
+	{
+		/* Characters beyond the directly-mapped low range */
+		STR expr = str_new("[\xce\xb1-\xcf\x89]?x");	/* [α-ω]?x */
+		struct globs *g = globs_new();
+		unsigned state;
+		globs_add(g, expr, refA);
+		globs_compile(g);
+		state = 0;
+		assert(!globs_step(g, 0x3b0, &state));
+		assert(!globs_step(g, 0x3ca, &state));
+		assert(!globs_step(g, MAXCHAR, &state));
+		assert(!globs_step(g, 'a', &state));
+		assert(state == 0);
+		assert(globs_step(g, 0x3c9, &state));
+		assert(globs_step(g, 0x10ffff, &state));
+		assert(!globs_step(g, '/', &state));
+		assert(globs_step(g, 'x', &state));
+		assert(globs_is_accept_state(g, state) == refA);
+		assert(!globs_step(g, 0x3b1, &state));
+		globs_free(g);
+	}
+	{
+		/* The UTF-8 byte automaton treats invalid UTF-8 the same
+		 * as the character automaton does */
+		static const char * const globs[] = {
+			"[\xce\xb1-\xcf\x89]*", "*x", "\xed\x9f\xbf?",
+			"\x85*", "[!a-z]?\xf4\x8f\xbf\xbf",
+			"*(\xe4\xb8\x80|\xf0\x90\x80\x80)",
+		};
+		static const char * const strs[] = {
+			"", "abc", "\xce\xb1\xce\xb2x", "\xcf\x8a",
+			"\x85", "\x85\x85", "\xc0\x80", "\xc1\xbf",
+			"\xe0\x80\x80", "\xe0\xa0\x80", "\xed\x9f\xbf",
+			"\xed\xa0\x80x", "\xef\xbf\xbf", "\xf0\x80\x80\x80",
+			"\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf",
+			"\xf4\x90\x80\x80", "\xf5\x80", "\xff", "\xce",
+			"\xe4\xb8", "\xe4\xb8\x80\xe4", "\xe4x\x80",
+			"\xf0\x90\x80", "a\xf0\x90\x80\x80\xe4\xb8\x80",
+		};
+		/* bytes to construct pseudo-random strings from */
+		static const char bytes[] = "ax/\x80\x85\xbf\xc2\xce"
+					    "\xe0\xe4\xed\xf0\xf4\xff";
+		const unsigned ngs = sizeof globs / sizeof globs[0];
+		const unsigned nss = sizeof strs / sizeof strs[0];
+		struct globs *g = globs_new();
+		struct globs *gb = globs_new();
+		unsigned i, j, seed = 1;
+		char buf[8];
+
+		for (i = 0; i < ngs; ++i) {
+			STR expr = str_new(globs[i]);
+			globs_add(g, expr, globs[i]);
+			globs_add(gb, expr, globs[i]);
+		}
+		globs_compile(g);
+		globs_compile_flags(gb, GLOBS_BYTES);
+		for (i = 0; i < nss; ++i)
+			assert_utf8_equiv(g, gb, strs[i], strlen(strs[i]));
+		for (i = 0; i < 10000; ++i) {
+			for (j = 0; j < sizeof buf; ++j) {
+				seed = seed * 1103515245 + 12345;
+				buf[j] = bytes[(seed >> 16) % (sizeof bytes - 1)];
+			}
+			assert_utf8_equiv(g, gb, buf, 1 + i % sizeof buf);
+		}
+		globs_free(gb);
+		globs_free(g);
+	}
+	{
+		/* Lazy DFA construction agrees with full construction,
+		 * even when its cache is continually flushed, and when
+		 * its states are discarded */
+		static const char * const globs[] = {
+			"*a???", "b*", "*(a|b)x", "[!a]*/*", "+(ab|ba)",
+		};
+		static const char alphabet[] = "abx/\xce\xb1";
+		const unsigned ngs = sizeof globs / sizeof globs[0];
+		struct globs *g = globs_new();
+		struct globs *gl = globs_new();
+		unsigned i, j, seed = 1;
+
+		for (i = 0; i < ngs; ++i) {
+			STR expr = str_new(globs[i]);
+			globs_add(g, expr, globs[i]);
+			globs_add(gl, expr, globs[i]);
+		}
+		globs_compile(g);
+		globs_set_cache_limit(gl, 1);
+		globs_compile_flags(gl, GLOBS_LAZY);
+		for (i = 0; i < 10000; ++i) {
+			unsigned state = 0, statel = 0;
+			/* (no state is held here, so all may be discarded) */
+			if (i % 1000 == 999)
+				globs_flush_states(gl);
+			assert(globs_is_accept_state(g, state) ==
+			       globs_is_accept_state(gl, statel));
+			for (j = 0; j < 1 + i % 8; ++j) {
+				unsigned ch;
+				int ok, okl;
+				seed = seed * 1103515245 + 12345;
+				ch = alphabet[(seed >> 16) %
+					(sizeof alphabet - 1)] & 0xff;
+				ok = globs_step(g, ch, &state);
+				okl = globs_step(gl, ch, &statel);
+				assert(ok == okl);
+				if (!ok)
+					break;
+				assert(globs_is_accept_state(g, state) ==
+				       globs_is_accept_state(gl, statel));
+			}
+		}
+		globs_free(gl);
+		globs_free(g);
+	}
+	{
+		/* Small globs are simulated; they agree with the DFA.
+		 * (The last has too many positions to simulate) */
+		static const char * const globs[] = {
+			"*a???", "+(ab|ba)", "[!a]*/*", "*(a|b)x", "b*",
+			"abxabxabxabxabxabxabxabxabxabxabx*",
+		};
+		static const char alphabet[] = "abx/\xce\xb1";
+		const unsigned ngs = sizeof globs / sizeof globs[0];
+		unsigned k, i, j, seed = 1;
+
+		for (k = 1; k <= ngs; ++k) {
+			struct globs *g = globs_new();
+			struct globs *gd = globs_new();
+
+			for (i = ngs - k; i < ngs; ++i) {
+				STR expr = str_new(globs[i]);
+				globs_add(g, expr, globs[i]);
+				globs_add(gd, expr, globs[i]);
+			}
+			globs_compile(g);
+			globs_compile_flags(gd, GLOBS_DFA);
+			for (i = 0; i < 2000; ++i) {
+				unsigned state = 0, stated = 0;
+				assert(globs_is_accept_state(g, state) ==
+				       globs_is_accept_state(gd, stated));
+				for (j = 0; j < 1 + i % 8; ++j) {
+					unsigned ch;
+					int ok, okd;
+					seed = seed * 1103515245 + 12345;
+					ch = alphabet[(seed >> 16) %
+						(sizeof alphabet - 1)] & 0xff;
+					ok = globs_step(g, ch, &state);
+					okd = globs_step(gd, ch, &stated);
+					assert(ok == okd);
+					if (!ok)
+						break;
+					assert(globs_is_accept_state(g, state)
+					    == globs_is_accept_state(gd,
+								     stated));
+				}
+			}
+			globs_free(gd);
+			globs_free(g);
+		}
+	}
+	{
+		/* All the refs of an accept state, in the order added,
+		 * in each mode and after adding more globs */
+		static const unsigned flags[] = {
+			0, GLOBS_DFA, GLOBS_BYTES, GLOBS_LAZY
+		};
+		static const char * const globs[] = {
+			"a*", "ab", "?b", "ab", "x",
+		};
+		static const char * const refs[] = {
+			"A", "B", "C", "A", "D",
+		};
+		const unsigned ngs = sizeof globs / sizeof globs[0];
+		unsigned f, i, k, nrefs;
+
+		for (f = 0; f < sizeof flags / sizeof flags[0]; ++f)
+		    for (k = 1; k < ngs; ++k) {
+			/* globs[0..k-1] are added before compiling */
+			struct globs *g = globs_new();
+			const void * const *r;
+			unsigned state = 0;
+
+			for (i = 0; i < ngs; ++i) {
+				STR expr = str_new(globs[i]);
+				if (i == k)
+					globs_compile_flags(g, flags[f]);
+				globs_add(g, expr, refs[i]);
+			}
+			assert(globs_step(g, 'a', &state));
+			assert(globs_step(g, 'b', &state));
+			r = globs_accept_refs(g, state, &nrefs);
+			assert(nrefs == 3);
+			assert(r[0] == refs[0]);
+			assert(r[1] == refs[1]);
+			assert(r[2] == refs[2]);
+			assert(globs_is_accept_state(g, state) == r[0]);
+			assert(globs_step(g, 'c', &state));
+			r = globs_accept_refs(g, state, &nrefs);
+			assert(nrefs == 1 && r[0] == refs[0]);
+			state = 0;
+			r = globs_accept_refs(g, state, &nrefs);
+			assert(nrefs == 0);
+			assert(globs_step(g, 'x', &state));
+			r = globs_accept_refs(g, state, &nrefs);
+			assert(nrefs == 1 && r[0] == refs[4]);
+			globs_free(g);
+		    }
+	}
+	{
+		/* State flags, in each mode */
+		static const unsigned flags[] = {
+			0, GLOBS_DFA, GLOBS_BYTES, GLOBS_LAZY
+		};
+		STR e1 = str_new("a*");
+		STR e2 = str_new("ab/");
+		STR e3 = str_new("abc");
+		const void * const refB = "B";
+		unsigned f;
+
+		for (f = 0; f < sizeof flags / sizeof flags[0]; ++f) {
+			struct globs *g = globs_new();
+			int dfa = flags[f] == GLOBS_DFA ||
+				  flags[f] == GLOBS_BYTES;
+			unsigned state = 0, sf;
+
+			globs_add(g, e3, refB);
+			globs_add(g, e1, refA);
+			globs_add(g, e2, refB);
+			globs_compile_flags(g, flags[f]);
+			assert(globs_state_flags(g, state) ==
+			       GLOBS_STATE_MORE);
+			assert(globs_step(g, 'a', &state));
+			/* "a" accepts all of a*, but "abc" has priority */
+			assert(globs_state_flags(g, state) ==
+			       GLOBS_STATE_MORE);
+			assert(globs_step(g, 'x', &state));
+			sf = globs_state_flags(g, state);
+			assert(sf == (GLOBS_STATE_MORE |
+				      (dfa ? GLOBS_STATE_ALL : 0)));
+			state = 0;
+			assert(globs_step(g, 'a', &state));
+			assert(globs_step(g, 'b', &state));
+			assert(globs_step(g, '/', &state));
+			assert(globs_is_accept_state(g, state) == refB);
+			assert(globs_state_flags(g, state) == 0);
+			globs_free(g);
+		}
+	}
+	{
+		/* Globs added after compilation, in any mode, agree
+		 * with globs that were all added before compilation,
+		 * in what they accept, their flags and their suffixes */
+		static const char * const globs[] = {
+			"*a???", "b*", "[c-x]y", "*(a|b)x", "[!a]*/*",
+			"+(ab|ba)", "??", "\xce\xb1*", "a/b",
+		};
+		static const char alphabet[] = "abcxy/\xce\xb1";
+		static const unsigned flags[] = { 0, GLOBS_BYTES, GLOBS_LAZY };
+		const unsigned ngs = sizeof globs / sizeof globs[0];
+		unsigned f, i, j, k, seed = 1;
+
+		for (f = 0; f < sizeof flags / sizeof flags[0]; ++f) {
+			struct globs *g = globs_new();
+			struct globs *gi = globs_new();
+
+			for (i = 0; i < ngs; ++i) {
+				STR expr = str_new(globs[i]);
+				globs_add(g, expr, globs[i]);
+			}
+			globs_compile(g);
+			if (flags[f] & GLOBS_LAZY)
+				globs_set_cache_limit(gi, 64);
+			for (i = 0; i < 2; ++i) {
+				STR expr = str_new(globs[i]);
+				globs_add(gi, expr, globs[i]);
+			}
+			globs_compile_flags(gi, flags[f]);
+			for (k = 2; k <= ngs; ++k) {
+				/* gi has globs[0..k-1] */
+				for (i = 0; i < 2000; ++i) {
+					unsigned state = 0, statei = 0;
+					if (k == ngs)
+						assert_same_state(g, state,
+								  gi, statei);
+					for (j = 0; j < 1 + i % 6; ++j) {
+						unsigned ch;
+						int ok, oki;
+						seed = seed * 1103515245 + 12345;
+						ch = alphabet[(seed >> 16) %
+							(sizeof alphabet - 1)] & 0xff;
+						ok = globs_step(g, ch, &state);
+						oki = globs_step(gi, ch, &statei);
+						if (k == ngs)
+							assert(ok == oki);
+						if (!ok || !oki)
+							break;
+						if (k == ngs)
+							assert_same_state(g, state,
+								gi, statei);
+					}
+				}
+				if (k < ngs) {
+					STR expr = str_new(globs[k]);
+					assert(!globs_add(gi, expr, globs[k]));
+				}
+			}
+			globs_free(gi);
+			globs_free(g);
+		}
+	}
+	{
+		/* A glob added after compilation that shares the ref of
+		 * an earlier glob narrows the earlier glob's suffix */
+		STR a = str_new("*_a.c");
+		STR b = str_new("*_b.c");
+		struct globs *g = globs_new();
+		char buf[GLOBS_SUFFIX_MAX];
+		unsigned state = 0;
+
+		globs_add(g, a, refA);
+		globs_compile(g);
+		assert(globs_state_suffix(g, 0, buf) == 4);
+		globs_add(g, b, refA);
+		assert(globs_state_suffix(g, 0, buf) == 2);
+		assert(globs_step(g, 'x', &state));
+		assert(globs_state_suffix(g, state, buf) == 2);
+		assert(memcmp(buf, ".c", 2) == 0);
+		globs_free(g);
+	}
+	{
+		/* The cost of adding a glob after compilation grows far
+		 * slower than the number of globs (the first add, which
+		 * converts a DFA, is not timed) */
+		assert(add_time(4096, GLOBS_LAZY) <
+		       16 * add_time(256, GLOBS_LAZY));
+		assert(add_time(1024, 0) < 4 * add_time(32, 0));
+	}
+	{
+		/* A state reached before a glob is added remains valid,
+		 * but only the initial state leads to the new glob */
+		STR ab = str_new("ab");
+		STR ac = str_new("ac");
+		const void * const refB = "B";
+		struct globs *g = globs_new();
+		unsigned state = 0, state2;
+		globs_add(g, ab, refA);
+		globs_compile(g);
+		assert(globs_step(g, 'a', &state));
+		globs_add(g, ac, refB);
+		state2 = state;
+		assert(!globs_step(g, 'c', &state2));
+		assert(globs_step(g, 'b', &state));
+		assert(globs_is_accept_state(g, state) == refA);
+		state = 0;
+		assert(globs_step(g, 'a', &state));
+		assert(globs_step(g, 'c', &state));
+		assert(globs_is_accept_state(g, state) == refB);
+		/* Recompiling merges the globs */
+		globs_compile(g);
+		state = 0;
+		assert(globs_step(g, 'a', &state));
+		assert(globs_step(g, 'b', &state));
+		assert(globs_is_accept_state(g, state) == refA);
+		globs_free(g);
+	}
+	{
+		/* Lazy construction of a DFA with 2^20 states */
+		STR expr = str_new("*a????????????????????");
+		struct globs *g = globs_new();
+		unsigned state = 0, i;
+		globs_add(g, expr, refA);
+		globs_set_cache_limit(g, 4096);
+		globs_compile_flags(g, GLOBS_LAZY);
+		for (i = 0; i < 10000; ++i)
+			assert(globs_step(g, "ab"[i % 3 == 0], &state));
+		assert(globs_step(g, 'a', &state));
+		for (i = 0; i < 20; ++i)
+			assert(globs_step(g, 'b', &state));
+		assert(globs_is_accept_state(g, state) == refA);
+		assert(globs_step(g, 'b', &state));
+		assert(!globs_is_accept_state(g, state));
+		globs_free(g);
+	}
 	{
 		assert_accepts("", "",
 				NOT, "a", "0");
 		assert_accepts("[abc]", "a","b","c",
 				NOT, "x",""," a", "aa");
+		assert_accepts("[!abc]", "x", "d", " ",
+				NOT, "a", "c", "/", "", "xx");
 		assert_accepts("@(a|b|c)", "a", "b", "c",
 				NOT, "", "d", "abc", "a|b|c");
 		assert_accepts("@(a)", "a",
@@ -148,6 +650,375 @@ main()
 				NOT, "ac", "d");
 		assert_accepts("*(*(a))", "", "a", "aa", "aaa",
 				NOT, " a");
+		assert_accepts("!(a)", "", "b", "aa", "ab", "ba",
+				NOT, "a", "a/", "/");
+		assert_accepts("!(lo|docker*)@UP", "eth0@UP", "@UP",
+				"l@UP", "loo@UP", "dock@UP", "xdocker@UP",
+				NOT, "lo@UP", "docker@UP", "docker0@UP",
+				"eth0@DOWN", "a/b@UP");
+		assert_accepts("!()", "a", "ab",
+				NOT, "", "/");
+		assert_accepts("!(*)", NOT, "", "a", "ab", "a/");
+		assert_accepts("!(a/b)", "", "a", "ab",
+				NOT, "a/b");
+		assert_accepts("!(!(ab))", "ab",
+				NOT, "", "a", "abc");
+		assert_accepts("!(a)*", "", "a", "aa", "b");
+		assert_accepts("x!(*.o|*.a)", "x", "xa.c", "xo",
+				NOT, "xa.o", "x.a");
+	}
+	{
+		/* Negation of a non-ASCII character */
+		STR expr = str_new("!(\xc3\xa9)");
+		struct globs *g = globs_new();
+		unsigned state = 0;
+		globs_add(g, expr, refA);
+		globs_compile(g);
+		assert(globs_step(g, 0xe9, &state));
+		assert(!globs_is_accept_state(g, state));
+		assert(globs_step(g, 0xe9, &state));
+		assert(globs_is_accept_state(g, state) == refA);
+		state = 0;
+		assert(globs_step(g, 0x10000, &state));
+		assert(globs_is_accept_state(g, state) == refA);
+		globs_free(g);
+	}
+	{
+		/* Literal globs mixed with patterns, in each mode */
+		static const unsigned flags[] = {
+			0, GLOBS_DFA, GLOBS_BYTES, GLOBS_LAZY
+		};
+		static const char * const exprs[] = {
+			"a*", "ab", "*(ab)", "abab", "[a-c]x", "bx",
+			"\xc3\xa9.txt", "[\xc3\xa0-\xc3\xbf]*", "ab", "q"
+		};
+		static const char * const refs[] = {
+			"0", "1", "2", "3", "4", "5", "6", "7", "1", "9"
+		};
+		static const struct {
+			const char *input;
+			const char *expect;	/* the refs, in order */
+		} tests[] = {
+			{ "", "2" },
+			{ "a", "0" },
+			{ "ab", "012" },
+			{ "abab", "023" },
+			{ "ababab", "02" },
+			{ "ax", "04" },
+			{ "bx", "45" },
+			{ "cx", "4" },
+			{ "b", "" },
+			{ "q", "9" },
+			{ "qq", "" },
+			{ "\xc3\xa9.txt", "67" },
+			{ "\xc3\xa9.tx", "7" },
+			{ "\xc3\xa8", "7" },
+		};
+		unsigned f, i, j;
+
+		for (f = 0; f < sizeof flags / sizeof flags[0]; ++f)
+		    for (i = 0; i < 2; ++i) {
+			struct globs *g = globs_new();
+
+			/* Second time round, add the last globs after
+			 * compiling */
+			for (j = 0; j < sizeof exprs / sizeof exprs[0]; ++j) {
+				STR expr = str_new(exprs[j]);
+				if (i && j == 8)
+					globs_compile_flags(g, flags[f]);
+				assert(!globs_add(g, expr, refs[j]));
+			}
+			globs_compile_flags(g, flags[f]);
+			for (j = 0; j < sizeof tests / sizeof tests[0]; ++j) {
+				STR input = str_new(tests[j].input);
+				const void * const *r = NULL;
+				unsigned state = 0, nrefs, k;
+				int ok = 1;
+				stri si;
+
+				for (si = stri_str(input); ok && stri_more(si); )
+					ok = globs_step_utf8(g, &si, &state);
+				if (!ok)
+					nrefs = 0;
+				else
+					r = globs_accept_refs(g, state, &nrefs);
+				assert(nrefs == strlen(tests[j].expect));
+				for (k = 0; k < nrefs; ++k)
+					assert(*(const char *)r[k] ==
+					       tests[j].expect[k]);
+			}
+			globs_free(g);
+		    }
+	}
+	{
+		/* Required suffixes, in each mode */
+		static const unsigned flags[] = {
+			0, GLOBS_DFA, GLOBS_BYTES, GLOBS_LAZY
+		};
+		STR e1 = str_new("x*@UP");
+		STR e2 = str_new("*/*\\*@UP");
+		STR e3 = str_new("y*.c");
+		STR e4 = str_new("y*b.c");
+		STR e5 = str_new("z*0123456789abcdefgh");
+		const void * const refB = "B";
+		const void * const refC = "C";
+		unsigned f;
+
+		for (f = 0; f < sizeof flags / sizeof flags[0]; ++f) {
+			struct globs *g = globs_new();
+			unsigned state = 0, len;
+			char buf[GLOBS_SUFFIX_MAX];
+
+			globs_add(g, e1, refA);
+			globs_add(g, e2, refC);
+			globs_add(g, e3, refB);
+			globs_compile_flags(g, flags[f]);
+			assert(globs_state_suffix(g, state, buf) == 0);
+			assert(globs_step(g, 'x', &state));
+			len = globs_state_suffix(g, state, buf);
+			assert(len == 3 && memcmp(buf, "@UP", 3) == 0);
+			assert(globs_step(g, '/', &state));
+			len = globs_state_suffix(g, state, buf);
+			assert(len == 4 && memcmp(buf, "*@UP", 4) == 0);
+			globs_free(g);
+
+			/* A ref's suffix is common to all its globs */
+			g = globs_new();
+			globs_add(g, e3, refB);
+			globs_add(g, e4, refB);
+			globs_compile_flags(g, flags[f]);
+			state = 0;
+			len = globs_state_suffix(g, state, buf);
+			assert(len == 2 && memcmp(buf, ".c", 2) == 0);
+			globs_add(g, e5, refB);
+			assert(globs_state_suffix(g, state, buf) == 0);
+			globs_free(g);
+
+			/* Only the end of a long suffix is kept */
+			g = globs_new();
+			globs_add(g, e5, refA);
+			globs_compile_flags(g, flags[f]);
+			state = 0;
+			len = globs_state_suffix(g, state, buf);
+			assert(len == GLOBS_SUFFIX_MAX);
+			assert(memcmp(buf, "3456789abcdefgh",
+				      GLOBS_SUFFIX_MAX) == 0);
+			globs_free(g);
+		}
+	}
+	{
+		/* Matching many strings at once, in each mode */
+		static const unsigned flags[] = {
+			0, GLOBS_DFA, GLOBS_BYTES, GLOBS_LAZY
+		};
+		static const char * const exprs[] = {
+			"*.c", "ab*", "*/x", "\xc3\xa9*", "abc"
+		};
+		static const char * const inputs[] = {
+			"a.c", "ab", "abc", "abc.c", "q/x", "", "b",
+			"\xc3\xa9t\xc3\xa9", "\xc3\xa9.c", "\xc3", "ab/x",
+			"x", "zz.c", "ab.c\xc3\xa9", "a/b/x",
+		};
+		const unsigned ninputs = sizeof inputs / sizeof inputs[0];
+		str *strs[2 * sizeof inputs / sizeof inputs[0] + 1];
+		const void *refs[2 * sizeof inputs / sizeof inputs[0] + 1];
+		unsigned f, j, k;
+
+		for (k = 0; k < ninputs; ++k) {
+			unsigned len = strlen(inputs[k]);
+			STR head = str_newn(inputs[k], len / 2);
+			STR tail = str_new(inputs[k] + len / 2);
+			strs[k] = str_new(inputs[k]);
+			/* The same string split into two segments */
+			strs[ninputs + k] = str_cat(head, tail);
+		}
+		strs[2 * ninputs] = NULL;
+
+		for (f = 0; f < sizeof flags / sizeof flags[0]; ++f) {
+			struct globs *g = globs_new();
+
+			for (j = 0; j < sizeof exprs / sizeof exprs[0]; ++j) {
+				STR expr = str_new(exprs[j]);
+				globs_add(g, expr, exprs[j]);
+			}
+			globs_compile_flags(g, flags[f]);
+			globs_match_many(g, (const str * const *)strs,
+					 2 * ninputs + 1, refs);
+			for (k = 0; k < 2 * ninputs + 1; ++k) {
+				unsigned state = 0;
+				int ok = 1;
+				stri si;
+
+				for (si = stri_str(strs[k]); ok && stri_more(si); )
+					ok = globs_step_utf8(g, &si, &state);
+				assert(refs[k] ==
+				       (ok ? globs_is_accept_state(g, state)
+					   : NULL));
+			}
+			assert(refs[1] == exprs[1]);
+			assert(refs[2] == exprs[1]);
+			assert(refs[4] == exprs[2]);
+			assert(refs[5] == NULL);
+			assert(refs[ninputs + 7] == exprs[3]);
+			assert(refs[2 * ninputs] == NULL);
+			globs_free(g);
+		}
+		for (k = 0; k < 2 * ninputs; ++k)
+			str_free(strs[k]);
+	}
+	{
+		/* Saving to and loading from a cache file */
+		static const unsigned flags[] = { GLOBS_DFA, GLOBS_BYTES };
+		static const char * const exprs[] = {
+			"*.c", "ab*", "*/x@UP", "\xc3\xa9*", "abc", "*.c"
+		};
+		static const char * const refs[] = {
+			"C", "AB", "X", "E", "ABC", "C"
+		};
+		static const char * const inputs[] = {
+			"a.c", "ab", "abc", "abc.c", "q/x@UP", "", "b",
+			"\xc3\xa9t\xc3\xa9", "\xe4\xb8\x80", "ab/x@UP",
+		};
+		const unsigned nexprs = sizeof exprs / sizeof exprs[0];
+		str *strs[sizeof exprs / sizeof exprs[0]];
+		char path[] = "/tmp/globs-t.XXXXXX";
+		unsigned f, j, k;
+		int fd;
+
+		fd = mkstemp(path);
+		assert(fd != -1);
+		close(fd);
+		for (j = 0; j < nexprs; ++j)
+			strs[j] = str_new(exprs[j]);
+
+		for (f = 0; f < sizeof flags / sizeof flags[0]; ++f) {
+			struct globs *g = globs_new();
+			struct globs *l;
+
+			for (j = 0; j < nexprs; ++j)
+				globs_add(g, strs[j], refs[j]);
+			globs_compile_flags(g, flags[f]);
+			assert(globs_save(g, path) == 0);
+
+			l = globs_load(path, (const str * const *)strs,
+				       (const void * const *)refs, nexprs);
+			assert(l);
+			for (k = 0; k < sizeof inputs / sizeof inputs[0]; ++k) {
+				STR input = str_new(inputs[k]);
+				unsigned sg = 0, sl = 0, ng, nl, i;
+				const void * const *rg, * const *rl;
+				int okg = 1, okl = 1;
+				char bufg[GLOBS_SUFFIX_MAX];
+				char bufl[GLOBS_SUFFIX_MAX];
+				stri ig, il;
+
+				for (ig = stri_str(input); okg && stri_more(ig); )
+					okg = globs_step_utf8(g, &ig, &sg);
+				for (il = stri_str(input); okl && stri_more(il); )
+					okl = globs_step_utf8(l, &il, &sl);
+				assert(okg == okl);
+				if (!okg)
+					continue;
+				assert(sg == sl);
+				rg = globs_accept_refs(g, sg, &ng);
+				rl = globs_accept_refs(l, sl, &nl);
+				assert(ng == nl);
+				for (i = 0; i < ng; ++i)
+					assert(rg[i] == rl[i]);
+				assert(globs_state_flags(g, sg) ==
+				       globs_state_flags(l, sl));
+				ng = globs_state_suffix(g, sg, bufg);
+				nl = globs_state_suffix(l, sl, bufl);
+				assert(ng == nl && memcmp(bufg, bufl, ng) == 0);
+			}
+			/* Loaded globs are read-only */
+			assert(globs_add(l, strs[0], refs[0]) != NULL);
+			globs_compile(l);
+			assert(globs_save(l, path) == -1);
+			globs_free(l);
+
+			/* Other globs do not load the file */
+			assert(!globs_load(path, (const str * const *)strs,
+					   (const void * const *)refs,
+					   nexprs - 1));
+			assert(!globs_load(path, (const str * const *)strs + 1,
+					   (const void * const *)refs,
+					   nexprs - 1));
+
+			/* Nor do tables out of range, here the classes
+			 * of the low characters */
+			{
+				char junk[512];
+
+				memset(junk, 0xff, sizeof junk);
+				fd = open(path, O_WRONLY);
+				assert(fd != -1);
+				assert(pwrite(fd, junk, sizeof junk, 512) ==
+				       sizeof junk);
+				close(fd);
+				assert(!globs_load(path,
+						   (const str * const *)strs,
+						   (const void * const *)refs,
+						   nexprs));
+			}
+
+			/* Nor do counts that overflow the file's size,
+			 * here nbounds (after the magic, key, sizes,
+			 * nglobs, nstates and nclasses), in a file
+			 * shortened to the size it would wrap to */
+			{
+				unsigned nbounds, huge = 0x80000001;
+				struct stat st;
+
+				assert(globs_save(g, path) == 0);
+				fd = open(path, O_RDWR);
+				assert(fd != -1);
+				assert(pread(fd, &nbounds, sizeof nbounds, 32) ==
+				       sizeof nbounds);
+				assert(pwrite(fd, &huge, sizeof huge, 32) ==
+				       sizeof huge);
+				assert(fstat(fd, &st) == 0);
+				assert(ftruncate(fd, st.st_size -
+					(2 * nbounds - 2) * sizeof (unsigned)) == 0);
+				close(fd);
+				assert(!globs_load(path,
+						   (const str * const *)strs,
+						   (const void * const *)refs,
+						   nexprs));
+
+				/* A truncated file does not load */
+				assert(globs_save(g, path) == 0);
+				assert(stat(path, &st) == 0);
+				assert(truncate(path, st.st_size - 1) == 0);
+				assert(!globs_load(path,
+						   (const str * const *)strs,
+						   (const void * const *)refs,
+						   nexprs));
+			}
+			globs_free(g);
+		}
+
+		/* Only DFAs can be saved */
+		{
+			struct globs *g = globs_new();
+			globs_add(g, strs[0], refs[0]);
+			globs_compile_flags(g, GLOBS_LAZY);
+			assert(globs_save(g, path) == -1);
+			globs_free(g);
+		}
+
+		/* A damaged file does not load */
+		fd = open(path, O_WRONLY | O_TRUNC);
+		assert(fd != -1);
+		assert(write(fd, "globs", 5) == 5);
+		close(fd);
+		assert(!globs_load(path, (const str * const *)strs,
+				   (const void * const *)refs, nexprs));
+		unlink(path);
+		assert(!globs_load(path, (const str * const *)strs,
+				   (const void * const *)refs, nexprs));
+		for (j = 0; j < nexprs; ++j)
+			str_free(strs[j]);
 	}
 	return 0;
 }
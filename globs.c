@@ -1,13 +1,196 @@
+#include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "globs.h"
 #include "str.h"
 #include "nfa.h"
 #include "cclass.h"
+#include "bitset.h"
 
+/* Transition table entry for "no transition" */
+#define NOSTATE (~0u)
+
+/* Number of leading characters mapped directly by globs.lowclass[] */
+#define NLOWCLASS 256
+
+/*
+ * A byte string that every string accepted from some node must end
+ * with. The bytes are right-aligned in bytes[].
+ */
+struct suffix {
+	unsigned char len;	/* or SUFFIX_NONE */
+	char bytes[GLOBS_SUFFIX_MAX];
+};
+
+/* Suffix length of a node that leads to no accept state */
+#define SUFFIX_NONE 0xff
+
+/* Initial key of an empty globs (the 64-bit FNV-1a offset basis) */
+#define KEY_INIT 0xcbf29ce484222325ull
+
+/*
+ * The compiled glob set.
+ *
+ * The DFA's edge cclasses partition the characters into alphabet
+ * classes: two characters are in the same class when every DFA node
+ * sends them along the same edge.  Class 0 is reserved for characters
+ * that no node accepts.
+ * Compilation tabulates the DFA into a dense trans[] array of
+ * nstates × nclasses destinations, so that globs_step() only has to
+ * look up the character's class, and then the next state.
+ */
 struct globs {
-	struct nfa dfa;
+	struct nfa dfa;		/* (first, so it can be nfa_dump()ed) */
+	unsigned nstates;
+	unsigned nclasses;
+	unsigned *trans;	/* [state * nclasses + class] -> state */
+	unsigned char *stateflags; /* GLOBS_STATE_* of each state */
+	unsigned lowclass[NLOWCLASS]; /* classes of the low characters */
+	unsigned nbounds;	/* Characters [bound[i],bound[i+1]) are */
+	unsigned *bound;	/*   all in class boundclass[i] */
+	unsigned *boundclass;
+	unsigned nbyterows;	/* UTF-8 byte automaton (GLOBS_BYTES) */
+	unsigned *bytes;	/* [row * 256 + byte] -> entry */
+	unsigned cache_limit;	/* GLOBS_LAZY cache limit, in bytes */
+	struct lazy *lazy;	/* GLOBS_LAZY states, or NULL */
+	struct bitsim *bitsim;	/* small NFA simulation, or NULL */
+	unsigned nglobs;	/* globs added so far */
+	unsigned nliterals;	/* literal globs, not yet in a DFA */
+	struct literal *literal;
+	unsigned refseqsz;	/* (a power of 2, or 0) */
+	unsigned nrefseqs;
+	struct refseq {
+		const void *ref;	/* NULL if unused */
+		unsigned seq;		/* the first glob with the ref */
+		struct suffix suffix;	/* common to the ref's globs */
+	} *refseq;
+	struct suffix *nodesuffix; /* required suffix of each node */
+	unsigned long long key;	/* hash of the globs added, for caching */
+	void *map;		/* cache file that the tables are in, or NULL */
+	size_t maplen;
+};
+
+/*
+ * A literal glob, which has no wildcards.
+ * Literals are parsed into the NFA like other globs, but when the
+ * globs are compiled into a DFA, they are left out of subset
+ * construction and are inserted into the DFA directly afterwards.
+ * This is much cheaper when the globs are mostly literals.
+ */
+struct literal {
+	str *str;		/* the glob */
+	const void *ref;
+	unsigned seq;		/* the glob's position in the globs */
+	unsigned edge;		/* index of its edge from NFA node 0 */
+};
+
+/*
+ * The lazily constructed DFA (GLOBS_LAZY).
+ *
+ * The globs' dfa member is left as an NFA.  Each DFA state is
+ * identified by a set of NFA nodes, and its transitions are found
+ * (as in subset construction) only when globs_step() needs them.
+ * Alphabet classes are the elementary intervals of the NFA edges.
+ * The rows of cached transitions are flushed when they would exceed
+ * the cache limit.  The state sets, refs and flags are kept, since
+ * callers hold state values; they are only discarded, along with
+ * those values, by globs_flush_states().
+ * This structure is mutable, even when its globs is const.
+ *
+ * Globs added after compilation are linked into the NFA from node 0,
+ * which has no incoming edges, so only state 0's set changes.  Their
+ * edges refine the alphabet classes by giving new class numbers to
+ * the characters they split off, which leaves the cached rows of the
+ * existing states valid: rows shorter than nclasses are extended with
+ * unknown transitions as needed.
+ */
+struct lazy {
+	unsigned nstates, capacity;
+	unsigned nbits;		/* capacity of each set, >= NFA nodes */
+	bitset **set;		/* NFA nodes of each state */
+	unsigned *nrefs;	/* number of final refs of each state */
+	const void ***refs;	/* final refs of each state, in order */
+	unsigned char *flags;	/* GLOBS_STATE_* of each state */
+	unsigned char *nodeflags; /* NODE_* of each NFA node */
+	unsigned **row;		/* cached transitions per state, or NULL */
+	unsigned *rowlen;	/* number of classes in each row */
+	unsigned hashsz;	/* (a power of 2) */
+	unsigned *hash;		/* state indicies by set, or NOSTATE */
+	unsigned *classlo;	/* a character in each class */
+	unsigned cache_used;	/* bytes of rows allocated */
+};
+
+/* Lazy row entry for a transition not yet computed */
+#define LAZY_UNKNOWN	(NOSTATE - 1)
+
+/* Default GLOBS_LAZY cache limit */
+#define LAZY_CACHE_LIMIT	(1024 * 1024)
+
+/*
+ * The UTF-8 byte automaton.
+ *
+ * Row s (for s < nstates) is where state s starts stepping the first
+ * byte of a character. The entries of a row are one of:
+ *    a state        the character is complete; this is its next state
+ *    NOSTATE        the character is complete, and was rejected
+ *    BYTE_MORE|r    read the next byte of the character using row r
+ *    BYTE_FALLBACK  the bytes are not valid UTF-8 (or are incomplete);
+ *                   decode them with stri_utf8_inc() and use the
+ *                   character automaton, so that invalid UTF-8 retains
+ *                   its 0xdc80|byte meaning.
+ * The rows after nstates are shared between states.
+ */
+#define BYTE_MORE	0x80000000u
+#define BYTE_FALLBACK	(BYTE_MORE - 1)
+
+/*
+ * The bit-parallel simulation of a small NFA.
+ *
+ * Small globs, such as a single literal goal, are cheaper to simulate
+ * than to compile into a DFA. The globs' dfa member is left as an NFA,
+ * and its positions, the nodes with non-epsilon edges or finals, are
+ * numbered in node order. A state is the mask of active positions,
+ * after epsilon closure, tagged with BITSIM_STATE; state 0 is the
+ * initial mask. The alphabet classes are those of GLOBS_LAZY.
+ *
+ * The successor masks of a class are tabulated for each group of
+ * four positions (a "nibble"), so that a step ORs together one table
+ * entry per group, however many positions are active.
+ *
+ * If globs are added after compilation, the globs convert to
+ * GLOBS_LAZY, and the bitsim is kept only to translate states that
+ * were reached before the conversion.
+ */
+struct bitsim {
+	unsigned npos;
+	unsigned *node;		/* NFA node of each position */
+	unsigned initial;	/* mask of the initial state */
+	unsigned final;		/* mask of the positions with finals */
+	unsigned live;		/* mask of the NODE_LIVE positions */
+	unsigned more;		/* mask of the NODE_MORE positions */
+	unsigned ngroups;	/* (npos + 3) / 4 */
+	unsigned *succ;		/* [(class * ngroups + group) * 16 + nibble]
+				 *   -> successor mask */
+	unsigned nrefsets;	/* refs of the accepting masks, as found */
+	unsigned refsetsz;	/*   (a power of 2, or 0) */
+	struct bitsim_refs {
+		unsigned mask;	/* final positions, or 0 if unused */
+		unsigned nrefs;
+		const void **refs;
+	} *refset;
 };
 
+/* At most this many positions can be simulated */
+#define BITSIM_MAX	31
+/* Tags the mask of a non-initial bitsim state */
+#define BITSIM_STATE	0x80000000u
+
 /*------------------------------------------------------------
  * glob parser
  */
@@ -29,6 +212,7 @@ struct subnfa {
 };
 
 static struct subnfa parse_sequence(struct nfa *nfa, stri *i); /* fwd decl */
+static cclass *question_cclass(void); /* fwd decl */
 
 #define IS_ERROR_SUBNFA(sub) ((sub).error)
 
@@ -90,10 +274,7 @@ subnfa_box(struct nfa *nfa, struct subnfa inner)
 
 
 /**
- * Parses one of: "?(.|..)" "*(.|..)" "+(.|..)" "@(.|..)" "!(.|..)"
- * into a subnfa.
- *
- * First the alt ::= (seq|..|seq) is parsed:
+ * Parses the alternatives "(.|..)" of a group into a subnfa.
  *    ┌──────────────┐
  *    │alt           │
  *    │   ┌─────┐    │
@@ -104,22 +285,10 @@ subnfa_box(struct nfa *nfa, struct subnfa inner)
  *    │└ε→○ seq ●─ε┘ │
  *    │   └─────┘    │
  *    └──────────────┘
- * Then the alt is wrapped in + * ? (@ means no change)
- *    ┌─────────────┐  ┌─────────────┐
- *    │+            │  │*            │  ┌─────────────┐
- *    │  ┌───ε───┐  │  │  ┌───ε───┐  │  │?            │
- *    │  ↓┌─────┐│  │  │  ↓┌─────┐│  │  │   ┌─────┐   │
- *    ○─ε→○ alt ●┴ε→●  ○┬ε→○ alt ●┴ε→●  ○┬ε→○ alt ●─ε→●
- *    │   └─────┘   │  ││  └─────┘  ↑│  ││  └─────┘  ↑│
- *    └─────────────┘  │└───────────┘│  │└───────────┘│
- *                     └─────────────┘  └─────────────┘
  */
 static struct subnfa
-parse_group(struct nfa *nfa, stri *i, unsigned kind)
+parse_alternatives(struct nfa *nfa, stri *i)
 {
-	if (kind == '!') {
-		return subnfa_error("!(...) is not supported");
-	}
 	stri_inc(*i); /* '(' */
 
 	struct subnfa alt = subnfa_frame(nfa);
@@ -146,7 +315,136 @@ parse_group(struct nfa *nfa, stri *i, unsigned kind)
 		/* empty alt, () */
 		nfa_new_edge(nfa, alt.entry, alt.exit);
 	}
+	return alt;
+}
+
+/*
+ * Returns the part of a cclass that ? can match, interned,
+ * or NULL if there is none.
+ */
+static cclass *
+question_part(const cclass *cc)
+{
+	struct cclass_builder b;
+	cclass *result;
+	unsigned k;
+
+	cclass_builder_init(&b);
+	for (k = 0; k < cc->nintervals; ++k) {
+		unsigned lo = cc->interval[k].lo, hi = cc->interval[k].hi;
+		if (lo < 1)
+			lo = 1;
+		if (lo < hi && lo < '/')
+			cclass_builder_add(&b, lo, hi < '/' ? hi : '/');
+		if (hi > '/' + 1)
+			cclass_builder_add(&b, lo > '/' + 1 ? lo : '/' + 1, hi);
+	}
+	result = cclass_builder_finish(&b);
+	cclass_builder_fini(&b);
+	if (cclass_is_empty(result)) {
+		cclass_free(result);
+		return NULL;
+	}
+	return cclass_intern(result);
+}
+
+/*
+ * Copies the complement of a DFA into an NFA. The complement is
+ * relative to the strings that * matches: it accepts the strings
+ * free of NUL and '/' that the DFA rejects.
+ * The DFA's missing transitions go to a new accepting sink node.
+ */
+static struct subnfa
+subnfa_complement(struct nfa *nfa, const struct nfa *dfa)
+{
+	struct subnfa sub = subnfa_frame(nfa);
+	unsigned *node = malloc(dfa->nnodes * sizeof *node);
+	unsigned sink = NOSTATE;
+	unsigned s, j;
+
+	for (s = 0; s < dfa->nnodes; ++s)
+		node[s] = s ? nfa_new_node(nfa) : sub.entry;
+	for (s = 0; s < dfa->nnodes; ++s) {
+		const struct node *n = &dfa->nodes[s];
+		cclass *used = cclass_new();
+		cclass *cc;
+
+		for (j = 0; j < n->nedges; ++j) {
+			cclass_addcc(used, n->edges[j].cclass);
+			if ((cc = question_part(n->edges[j].cclass)))
+				nfa_new_edge(nfa, node[s],
+					node[n->edges[j].dest])->cclass = cc;
+		}
+		cclass_invert(used);
+		if ((cc = question_part(used))) {
+			if (sink == NOSTATE) {
+				sink = nfa_new_node(nfa);
+				nfa_new_edge(nfa, sink, sink)->cclass =
+					question_cclass();
+				nfa_new_edge(nfa, sink, sub.exit);
+			}
+			nfa_new_edge(nfa, node[s], sink)->cclass = cc;
+		}
+		cclass_free(used);
+		if (!n->nfinals)
+			nfa_new_edge(nfa, node[s], sub.exit);
+	}
+	free(node);
+	return sub;
+}
+
+/*
+ * Parses !(...), which matches the strings that * matches,
+ * except those that the alternatives match. The alternatives are
+ * built into their own NFA and made deterministic, so that they can
+ * be complemented.
+ */
+static struct subnfa
+parse_negation(struct nfa *nfa, stri *i)
+{
+	struct nfa alts;
+	struct subnfa alt, ret;
+
+	nfa_init(&alts);
+	alt = parse_alternatives(&alts, i);
+	if (IS_ERROR_SUBNFA(alt)) {
+		nfa_fini(&alts);
+		return alt;
+	}
+	/* (alt.entry is node 0, where nfa_to_dfa() starts) */
+	nfa_add_final(&alts, alt.exit, &alts);
+	nfa_to_dfa(&alts);
+	ret = subnfa_complement(nfa, &alts);
+	nfa_fini(&alts);
+	return ret;
+}
+
+/**
+ * Parses one of: "?(.|..)" "*(.|..)" "+(.|..)" "@(.|..)" "!(.|..)"
+ * into a subnfa.
+ *
+ * First the alt ::= (seq|..|seq) is parsed (see #parse_alternatives()).
+ * Then the alt is wrapped in + * ? (@ means no change)
+ *    ┌─────────────┐  ┌─────────────┐
+ *    │+            │  │*            │  ┌─────────────┐
+ *    │  ┌───ε───┐  │  │  ┌───ε───┐  │  │?            │
+ *    │  ↓┌─────┐│  │  │  ↓┌─────┐│  │  │   ┌─────┐   │
+ *    ○─ε→○ alt ●┴ε→●  ○┬ε→○ alt ●┴ε→●  ○┬ε→○ alt ●─ε→●
+ *    │   └─────┘   │  ││  └─────┘  ↑│  ││  └─────┘  ↑│
+ *    └─────────────┘  │└───────────┘│  │└───────────┘│
+ *                     └─────────────┘  └─────────────┘
+ * A ! group is instead complemented (see #parse_negation()).
+ */
+static struct subnfa
+parse_group(struct nfa *nfa, stri *i, unsigned kind)
+{
+	if (kind == '!')
+		return parse_negation(nfa, i);
 
+	struct subnfa alt = parse_alternatives(nfa, i);
+	if (IS_ERROR_SUBNFA(alt)) {
+		return alt;
+	}
 	struct subnfa ret = subnfa_box(nfa, alt);
 	switch (kind) {
 	case '?':
@@ -173,11 +471,11 @@ static struct subnfa
 parse_cclass(struct nfa *nfa, stri *i)
 {
 	struct subnfa sub = subnfa_frame(nfa);
-	cclass *cc = cclass_new();
+	struct cclass_builder ranges;
+	cclass *cc;
 	int invert = 0;
-	struct edge *edge;
-	edge = nfa_new_edge(nfa, sub.entry, sub.exit);
-	edge->cclass = cc;
+
+	cclass_builder_init(&ranges);
 
 	if (stri_more(*i) &&
 	    (stri_at(*i) == '!' || stri_at(*i) == '^'))
@@ -186,12 +484,13 @@ parse_cclass(struct nfa *nfa, stri *i)
 		stri_inc(*i);
 	}
 	if (stri_more(*i) && stri_at(*i) == ']') {
-		cclass_add(cc, ']', ']' + 1);
+		cclass_builder_add(&ranges, ']', ']' + 1);
 		stri_inc(*i);
 	}
 	for (;;) {
 		unsigned lo, hi;
 		if (!stri_more(*i)) {
+			cclass_builder_fini(&ranges);
 			return subnfa_error("unclosed [");
 		}
 		lo = stri_utf8_inc(i);
@@ -202,6 +501,7 @@ parse_cclass(struct nfa *nfa, stri *i)
 		if (stri_more(*i) && stri_at(*i) == '-') {
 			stri_inc(*i);
 			if (!stri_more(*i)) {
+				cclass_builder_fini(&ranges);
 				return subnfa_error("unclosed [");
 			}
 			hi = stri_utf8_inc(i);
@@ -211,33 +511,38 @@ parse_cclass(struct nfa *nfa, stri *i)
 			hi = lo;
 		}
 		if (hi < lo) {
+			cclass_builder_fini(&ranges);
 			return subnfa_error("bad character class");
 		}
 		if (lo == '/' || hi == '/') {
+			cclass_builder_fini(&ranges);
 			return subnfa_error(
 				"cannot have / in character class");
 		}
 		if (lo < '/' && '/' < hi) {
 			/* remove / from implied range */
-			cclass_add(cc, lo, '/');
-			cclass_add(cc, '/' + 1, hi + 1);
+			cclass_builder_add(&ranges, lo, '/');
+			cclass_builder_add(&ranges, '/' + 1, hi + 1);
 		} else {
-			cclass_add(cc, lo, hi + 1);
+			cclass_builder_add(&ranges, lo, hi + 1);
 		}
 	}
 	if (invert) {
 		/* add / now so that it is removed during inversion */
-		cclass_add(cc, '/', '/' + 1);
-		edge->cclass = cclass_invert(cc);
-		cclass_free(cc);
-		cc = edge->cclass;
+		cclass_builder_add(&ranges, '/', '/' + 1);
 	}
+	cc = cclass_builder_finish(&ranges);
+	cclass_builder_fini(&ranges);
+	if (invert)
+		cclass_invert(cc);
+	nfa_new_edge(nfa, sub.entry, sub.exit)->cclass = cclass_intern(cc);
 	return sub;
 }
 
 /**
  * Create the 'any' cclass corresponding to the glob "?".
  * The resulting cclass matches any character except '/' and NUL.
+ * It is interned, as are all the globs' cclasses.
  */
 static cclass *
 question_cclass()
@@ -245,7 +550,7 @@ question_cclass()
 	cclass *cc = cclass_new();
 	cclass_add(cc, 1, '/');
 	cclass_add(cc, '/' + 1, MAXCHAR);
-	return cc;
+	return cclass_intern(cc);
 }
 
 /**
@@ -289,6 +594,7 @@ parse_atom(struct nfa *nfa, stri *i)
 			ch = stri_utf8_inc(i);
 		}
 		cclass_add(cc, ch, ch + 1);
+		cc = cclass_intern(cc);
 	}
 	sub = subnfa_frame(nfa);
 	nfa_new_edge(nfa, sub.entry, sub.exit)->cclass = cc;
@@ -328,19 +634,75 @@ parse_sequence(struct nfa *nfa, stri *i)
 	return seq;
 }
 
+static void lazy_free(struct lazy *lazy); /* fwd decl */
+static void bitsim_free(struct bitsim *bitsim); /* fwd decl */
+static void bitsim_thaw(struct globs *globs); /* fwd decl */
+static int glob_is_literal(const str *globstr); /* fwd decl */
+static int refseq_add(struct globs *globs, const void *ref,
+		      unsigned seq, const str *globstr); /* fwd decl */
+static void globs_set_suffixes(struct globs *globs); /* fwd decl */
+static void globs_add_suffixes(struct globs *globs,
+			       unsigned first); /* fwd decl */
+static void cache_unmap(struct globs *globs); /* fwd decl */
+static unsigned long long key_update(unsigned long long key,
+				     const str *globstr); /* fwd decl */
+static const struct refseq *refseq_find(const struct globs *globs,
+					 const void *ref); /* fwd decl */
+static void globs_thaw(struct globs *globs); /* fwd decl */
+static void lazy_add(struct globs *globs, unsigned first,
+		     unsigned entry); /* fwd decl */
+
 struct globs *
 globs_new()
 {
 	struct globs *globs = malloc(sizeof *globs);
 
 	nfa_init(&globs->dfa);
+	globs->nstates = 0;
+	globs->nclasses = 0;
+	globs->trans = 0;
+	globs->stateflags = 0;
+	globs->nbounds = 0;
+	globs->bound = 0;
+	globs->boundclass = 0;
+	globs->nbyterows = 0;
+	globs->bytes = 0;
+	globs->cache_limit = LAZY_CACHE_LIMIT;
+	globs->lazy = 0;
+	globs->bitsim = 0;
+	globs->nglobs = 0;
+	globs->nliterals = 0;
+	globs->literal = 0;
+	globs->refseqsz = 0;
+	globs->nrefseqs = 0;
+	globs->refseq = 0;
+	globs->nodesuffix = 0;
+	globs->key = KEY_INIT;
+	globs->map = 0;
+	globs->maplen = 0;
 	return globs;
 }
 
 void
 globs_free(struct globs *globs)
 {
+	unsigned i;
+
+	if (globs->map)
+		cache_unmap(globs);
 	nfa_fini(&globs->dfa);
+	free(globs->trans);
+	free(globs->stateflags);
+	free(globs->bound);
+	free(globs->boundclass);
+	free(globs->bytes);
+	lazy_free(globs->lazy);
+	bitsim_free(globs->bitsim);
+	for (i = 0; i < globs->nliterals; ++i)
+		str_free(globs->literal[i].str);
+	free(globs->literal);
+	free(globs->refseq);
+	free(globs->nodesuffix);
 	free(globs);
 }
 
@@ -349,48 +711,2449 @@ globs_add(struct globs *globs, const str *globstr, const void *ref)
 {
 	struct nfa *nfa = &globs->dfa;
 	stri ip = stri_str(globstr);
+	unsigned first, edge;
+	int narrowed;
+
+	if (globs->map)
+		return "globs loaded from a cache cannot be extended";
+	if (globs->bitsim && !globs->lazy)
+		bitsim_thaw(globs);	/* already compiled */
+	else if (globs->nclasses && !globs->lazy)
+		globs_thaw(globs);	/* already compiled */
+	first = nfa->nnodes;
+
 	struct subnfa outer = subnfa_frame(nfa);
 	struct subnfa seq = parse_sequence(nfa, &ip);
 	if (IS_ERROR_SUBNFA(seq)) {
 		return seq.error;
 	}
+	/* The first glob's entry is the initial node 0; the
+	 * later globs are alternatives to it */
+	edge = nfa->nodes[0].nedges;
+	if (outer.entry != 0)
+		nfa_new_edge(nfa, 0, outer.entry);
 	nfa_new_edge(nfa, outer.entry, seq.entry);
 	nfa_new_edge(nfa, seq.exit, outer.exit);
 	nfa_add_final(nfa, outer.exit, ref);
+
+	narrowed = refseq_add(globs, ref, globs->nglobs, globstr);
+	if (glob_is_literal(globstr)) {
+		struct literal *lit;
+
+		if ((globs->nliterals & (globs->nliterals - 1)) == 0)
+			globs->literal = realloc(globs->literal,
+				(globs->nliterals ? 2 * globs->nliterals : 1) *
+				sizeof *globs->literal);
+		lit = &globs->literal[globs->nliterals++];
+		lit->str = str_dup(globstr);
+		lit->ref = ref;
+		lit->seq = globs->nglobs;
+		lit->edge = edge;
+	}
+	globs->key = key_update(globs->key, globstr);
+	globs->nglobs++;
+	if (globs->lazy) {
+		lazy_add(globs, first, outer.entry);
+		/* A ref that an earlier glob has narrows the suffixes
+		 * of its nodes too */
+		if (narrowed)
+			globs_set_suffixes(globs);
+		else
+			globs_add_suffixes(globs, first);
+	}
 	return NULL;
 }
 
-void
-globs_compile(struct globs *globs)
+/*------------------------------------------------------------
+ * DFA tabulation
+ */
+
+/* Flags of NFA nodes, from #nfa_node_flags() */
+#define NODE_LIVE	0x1	/* some path leads to a final */
+#define NODE_MORE	0x2	/* a non-epsilon edge leads to a live node */
+
+/*
+ * Collects the predecessors of each node of a graph, from node lo on.
+ * Only the edges between nodes lo.. are counted, which must not lead
+ * to nodes before lo. The predecessors of node lo + n are
+ * pred[n ? end[n - 1] : 0 .. end[n]).
+ * @param lo          the first node
+ * @param end_return  where to store the new array of ends
+ * @returns the new array of predecessors
+ */
+static unsigned *
+nfa_preds(const struct nfa *nfa, unsigned lo, unsigned **end_return)
 {
-	nfa_to_dfa(&globs->dfa);
+	const unsigned n = nfa->nnodes - lo;
+	unsigned *first, *pred;
+	unsigned i, j;
+
+	first = calloc(n + 1, sizeof *first);
+	for (i = lo; i < nfa->nnodes; ++i)
+		for (j = 0; j < nfa->nodes[i].nedges; ++j)
+			first[nfa->nodes[i].edges[j].dest - lo + 1]++;
+	for (i = 0; i < n; ++i)
+		first[i + 1] += first[i];
+	pred = malloc((first[n] + 1) * sizeof *pred);
+	for (i = lo; i < nfa->nnodes; ++i)
+		for (j = 0; j < nfa->nodes[i].nedges; ++j)
+			pred[first[nfa->nodes[i].edges[j].dest - lo]++] = i;
+	/* (each first[d] now points to the end of d's predecessors) */
+	*end_return = first;
+	return pred;
 }
 
-int
-globs_step(const struct globs *globs, unsigned ch, unsigned *statep)
+/*
+ * Finds which of the nodes lo.. of a graph can still reach a final
+ * node, by searching backwards from the finals. The nodes lo.. must
+ * not lead to nodes before lo.
+ * @param flags  the NODE_* flags of each node, set from node lo on
+ * @param lo     the first node
+ */
+static void
+nfa_node_flags_from(const struct nfa *nfa, unsigned char *flags, unsigned lo)
 {
-        const struct node *node = &globs->dfa.nodes[*statep];
-        unsigned j;
+	const unsigned nnodes = nfa->nnodes;
+	unsigned *first, *pred, *queue;
+	unsigned i, j, n, qlen;
 
-        /* TODO replace this with a binary search, because the
-         * edge array of a dfa node will be ordered by
-         * their (non-overlapping) cclass fields */
-        for (j = 0; j < node->nedges; ++j) {
-                const struct edge *edge = &node->edges[j];
-                if (cclass_contains_ch(edge->cclass, ch)) {
-                        *statep = edge->dest;
-                        return 1;
-                }
-        }
-        return 0;
+	pred = nfa_preds(nfa, lo, &first);
+	queue = malloc((nnodes - lo + 1) * sizeof *queue);
+	qlen = 0;
+	for (i = lo; i < nnodes; ++i) {
+		flags[i] = 0;
+		if (nfa->nodes[i].nfinals) {
+			flags[i] = NODE_LIVE;
+			queue[qlen++] = i;
+		}
+	}
+	while (qlen) {
+		n = queue[--qlen] - lo;
+		for (j = n ? first[n - 1] : 0; j < first[n]; ++j) {
+			i = pred[j];
+			if (flags[i] & NODE_LIVE)
+				continue;
+			flags[i] |= NODE_LIVE;
+			queue[qlen++] = i;
+		}
+	}
+	for (i = lo; i < nnodes; ++i)
+		for (j = 0; j < nfa->nodes[i].nedges; ++j)
+			if (nfa->nodes[i].edges[j].cclass &&
+			    (flags[nfa->nodes[i].edges[j].dest] & NODE_LIVE))
+				flags[i] |= NODE_MORE;
+	free(queue);
+	free(pred);
+	free(first);
 }
 
-const void *
-globs_is_accept_state(const struct globs *globs, unsigned state)
+/*
+ * Finds which nodes of a graph can still reach a final node.
+ * @returns a new array of the NODE_* flags of each node
+ */
+static unsigned char *
+nfa_node_flags(const struct nfa *nfa)
 {
-        const struct node *node = &globs->dfa.nodes[state];
+	unsigned char *flags = calloc(nfa->nnodes + 1, sizeof *flags);
 
-	if (!node->nfinals)
-		return NULL;
-	return node->finals[0];
+	nfa_node_flags_from(nfa, flags, 0);
+	return flags;
+}
+
+/* Unsigned integer comparator for qsort */
+static int
+unsigned_cmp(const void *a, const void *b)
+{
+	unsigned aval = *(const unsigned *)a;
+	unsigned bval = *(const unsigned *)b;
+
+	return aval < bval ? -1 : aval > bval;
+}
+
+/*
+ * Finds the index i of the interval [bound[i],bound[i+1]) that
+ * contains ch.
+ * The bound[] array must be sorted, with bound[0] <= ch < bound[n-1].
+ */
+static unsigned
+bound_index(const unsigned *bound, unsigned n, unsigned ch)
+{
+	unsigned lo = 0, hi = n - 1;
+
+	while (hi - lo > 1) {
+		unsigned mid = (lo + hi) / 2;
+		if (ch < bound[mid])
+			hi = mid;
+		else
+			lo = mid;
+	}
+	return lo;
+}
+
+/* Hashes a column of the transition table */
+static unsigned
+column_hash(const unsigned *col, unsigned n)
+{
+	unsigned h = 2166136261u;
+	unsigned i;
+
+	for (i = 0; i < n; ++i)
+		h = (h ^ col[i]) * 16777619u;
+	return h;
+}
+
+/*
+ * Collects the bounds of all the edge intervals in the graph.
+ * Adjacent bounds delimit the elementary intervals of characters that
+ * each edge either wholly contains or wholly excludes.
+ *
+ * @param nfa             the graph whose edges to collect
+ * @param nbreaks_return  where to store the number of bounds
+ *
+ * @returns the sorted, unique bounds, always including 0 and MAXCHAR
+ */
+static unsigned *
+edge_breaks(const struct nfa *nfa, unsigned *nbreaks_return)
+{
+	unsigned nbreaks, i, j, s;
+	unsigned *breaks;
+
+	nbreaks = 2;
+	for (s = 0; s < nfa->nnodes; ++s)
+		for (j = 0; j < nfa->nodes[s].nedges; ++j)
+			if (nfa->nodes[s].edges[j].cclass)
+				nbreaks += 2 * nfa->nodes[s].edges[j]
+						.cclass->nintervals;
+	breaks = malloc(nbreaks * sizeof *breaks);
+	nbreaks = 0;
+	breaks[nbreaks++] = 0;
+	breaks[nbreaks++] = MAXCHAR;
+	for (s = 0; s < nfa->nnodes; ++s) {
+		const struct node *n = &nfa->nodes[s];
+		for (j = 0; j < n->nedges; ++j) {
+			const cclass *cc = n->edges[j].cclass;
+			if (!cc)
+				continue;
+			for (i = 0; i < cc->nintervals; ++i) {
+				breaks[nbreaks++] = cc->interval[i].lo;
+				breaks[nbreaks++] = cc->interval[i].hi;
+			}
+		}
+	}
+	qsort(breaks, nbreaks, sizeof *breaks, unsigned_cmp);
+	for (i = j = 1; i < nbreaks; ++i)
+		if (breaks[i] != breaks[j - 1])
+			breaks[j++] = breaks[i];
+	*nbreaks_return = j;
+	return breaks;
+}
+
+/*
+ * Stores the mapping from characters to alphabet classes.
+ *
+ * @param breaks     the bounds from #edge_breaks()
+ * @param nbreaks    the number of bounds
+ * @param elemclass  the class of each elementary interval
+ *                   [breaks[e],breaks[e+1])
+ */
+static void
+globs_set_classes(struct globs *globs, const unsigned *breaks,
+		  unsigned nbreaks, const unsigned *elemclass)
+{
+	unsigned i, j, e;
+
+	/* Map the low characters directly */
+	for (i = 0, e = 0; i < NLOWCLASS; ++i) {
+		while (breaks[e + 1] <= i)
+			e++;
+		globs->lowclass[i] = elemclass[e];
+	}
+
+	/* Coalesce adjacent elementary intervals of the same class
+	 * for the binary search of higher characters */
+	globs->bound = malloc(nbreaks * sizeof *globs->bound);
+	globs->boundclass = malloc((nbreaks - 1) * sizeof *globs->boundclass);
+	for (e = j = 0; e + 1 < nbreaks; ++e) {
+		if (j && globs->boundclass[j - 1] == elemclass[e])
+			continue;
+		globs->bound[j] = breaks[e];
+		globs->boundclass[j] = elemclass[e];
+		j++;
+	}
+	globs->bound[j] = MAXCHAR;
+	globs->nbounds = j + 1;
+}
+
+/*
+ * Converts the DFA's edge lists into the dense transition table,
+ * and computes the alphabet classes.
+ *
+ * First, the bounds of every edge interval break the character space
+ * into elementary intervals, and a column of destinations is computed
+ * for each elementary interval.  Then, elementary intervals with equal
+ * columns are merged into the same alphabet class.
+ */
+static void
+globs_tabulate(struct globs *globs)
+{
+	const struct nfa *dfa = &globs->dfa;
+	const unsigned nstates = dfa->nnodes;
+	unsigned nbreaks, nelem, i, j, k, s, e;
+	unsigned *breaks, *col, *elemclass;
+	unsigned *hash, hashsz;
+	unsigned nclasses;
+
+	breaks = edge_breaks(dfa, &nbreaks);
+	nelem = nbreaks - 1;
+
+	/* Compute the destination column for each elementary interval */
+	col = malloc(nelem * nstates * sizeof *col);
+	for (i = 0; i < nelem * nstates; ++i)
+		col[i] = NOSTATE;
+	for (s = 0; s < nstates; ++s) {
+		const struct node *n = &dfa->nodes[s];
+		for (j = 0; j < n->nedges; ++j) {
+			const cclass *cc = n->edges[j].cclass;
+			for (i = 0; i < cc->nintervals; ++i) {
+				e = bound_index(breaks, nbreaks,
+						cc->interval[i].lo);
+				for (; breaks[e] < cc->interval[i].hi; ++e)
+					col[e * nstates + s] =
+						n->edges[j].dest;
+			}
+		}
+	}
+
+	/* Merge equal columns into classes, using a hash table
+	 * of class representatives. Class 0 is the empty column. */
+	for (hashsz = 16; hashsz < 2 * (nelem + 1); hashsz *= 2)
+		;
+	hash = malloc(hashsz * sizeof *hash);
+	for (i = 0; i < hashsz; ++i)
+		hash[i] = NOSTATE;
+	elemclass = malloc(nelem * sizeof *elemclass);
+	globs->trans = malloc((nelem + 1) * nstates * sizeof *globs->trans);
+	for (s = 0; s < nstates; ++s)
+		globs->trans[s] = NOSTATE;
+	hash[column_hash(globs->trans, nstates) & (hashsz - 1)] = 0;
+	nclasses = 1;
+	for (e = 0; e < nelem; ++e) {
+		const unsigned *ecol = &col[e * nstates];
+		unsigned h = column_hash(ecol, nstates) & (hashsz - 1);
+		while ((k = hash[h]) != NOSTATE &&
+		       memcmp(&globs->trans[k * nstates], ecol,
+			      nstates * sizeof *ecol) != 0)
+			h = (h + 1) & (hashsz - 1);
+		if (k == NOSTATE) {
+			k = hash[h] = nclasses++;
+			memcpy(&globs->trans[k * nstates], ecol,
+			       nstates * sizeof *ecol);
+		}
+		elemclass[e] = k;
+	}
+	free(hash);
+	free(col);
+
+	/* The class columns were collected class-major; transpose them
+	 * so that each state's row is contiguous */
+	col = globs->trans;
+	globs->trans = malloc(nstates * nclasses * sizeof *globs->trans);
+	for (k = 0; k < nclasses; ++k)
+		for (s = 0; s < nstates; ++s)
+			globs->trans[s * nclasses + k] = col[k * nstates + s];
+	free(col);
+	globs->nstates = nstates;
+	globs->nclasses = nclasses;
+
+	globs_set_classes(globs, breaks, nbreaks, elemclass);
+	free(elemclass);
+	free(breaks);
+}
+
+/*
+ * Computes the GLOBS_STATE_* flags of the tabulated DFA's states.
+ * A state accepts all suffixes when every character other than
+ * NUL and '/' leads to a state that does too, with the same ref.
+ * This is the greatest such set of states, found by repeatedly
+ * discarding the accepting states that lead outside it.
+ */
+static void
+globs_state_flags_tabulate(struct globs *globs)
+{
+	const struct nfa *dfa = &globs->dfa;
+	const unsigned nstates = globs->nstates;
+	const unsigned nclasses = globs->nclasses;
+	unsigned char *nodeflags = nfa_node_flags(dfa);
+	unsigned char *inpath;	/* classes with chars other than NUL, / */
+	unsigned char *all;
+	unsigned changed, s, c, j, t;
+
+	inpath = calloc(nclasses, sizeof *inpath);
+	for (j = 0; j + 1 < globs->nbounds; ++j) {
+		unsigned lo = globs->bound[j], hi = globs->bound[j + 1];
+		unsigned n = hi - lo;
+		if (lo == 0)
+			n--;
+		if (lo <= '/' && '/' < hi)
+			n--;
+		if (n)
+			inpath[globs->boundclass[j]] = 1;
+	}
+
+	all = malloc(nstates * sizeof *all);
+	for (s = 0; s < nstates; ++s)
+		all[s] = dfa->nodes[s].nfinals != 0;
+	do {
+		changed = 0;
+		for (s = 0; s < nstates; ++s) {
+			const unsigned *trans = &globs->trans[s * nclasses];
+			if (!all[s])
+				continue;
+			for (c = 0; c < nclasses; ++c) {
+				if (!inpath[c])
+					continue;
+				t = trans[c];
+				if (t == NOSTATE || !all[t] ||
+				    dfa->nodes[t].finals[0] !=
+				    dfa->nodes[s].finals[0])
+					break;
+			}
+			if (c < nclasses) {
+				all[s] = 0;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	globs->stateflags = malloc(nstates * sizeof *globs->stateflags);
+	for (s = 0; s < nstates; ++s)
+		globs->stateflags[s] =
+			(nodeflags[s] & NODE_LIVE ? 0 : GLOBS_STATE_DEAD) |
+			(nodeflags[s] & NODE_MORE ? GLOBS_STATE_MORE : 0) |
+			(all[s] ? GLOBS_STATE_ALL : 0);
+	free(all);
+	free(inpath);
+	free(nodeflags);
+}
+
+/* Returns the alphabet class of a character */
+static inline unsigned
+globs_class(const struct globs *globs, unsigned ch)
+{
+	if (ch < NLOWCLASS)
+		return globs->lowclass[ch];
+	if (ch >= MAXCHAR)
+		return 0;
+	return globs->boundclass[bound_index(globs->bound, globs->nbounds, ch)];
+}
+
+/*------------------------------------------------------------
+ * Required suffixes
+ */
+
+/*
+ * Narrows suffix a to the part it has in common with suffix b.
+ * @returns non-zero if a changed
+ */
+static int
+suffix_meet(struct suffix *a, const struct suffix *b)
+{
+	const char *ea = a->bytes + GLOBS_SUFFIX_MAX;
+	const char *eb = b->bytes + GLOBS_SUFFIX_MAX;
+	unsigned n;
+
+	if (b->len == SUFFIX_NONE)
+		return 0;
+	if (a->len == SUFFIX_NONE) {
+		*a = *b;
+		return 1;
+	}
+	for (n = 0; n < a->len && n < b->len; ++n)
+		if (*--ea != *--eb)
+			break;
+	if (n == a->len)
+		return 0;
+	a->len = n;
+	return 1;
+}
+
+/*
+ * Finds the literal text at the end of a glob, which every string
+ * that the glob matches must end with. Only the last
+ * GLOBS_SUFFIX_MAX bytes are kept.
+ */
+static void
+glob_suffix(const str *globstr, struct suffix *suf)
+{
+	char *end = suf->bytes + GLOBS_SUFFIX_MAX;
+	stri i;
+	char ch;
+
+	suf->len = 0;
+	for (i = stri_str(globstr); stri_more(i); stri_inc(i)) {
+		switch (ch = stri_at(i)) {
+		case '?': case '*': case '[': case ']':
+		case '(': case ')': case '|':
+			suf->len = 0;
+			continue;
+		case '\\':
+			stri_inc(i);
+			if (!stri_more(i)) {
+				suf->len = 0;
+				return;
+			}
+			ch = stri_at(i);
+			break;
+		}
+		if (suf->len < GLOBS_SUFFIX_MAX)
+			suf->len++;
+		memmove(end - suf->len, end - suf->len + 1, suf->len - 1);
+		end[-1] = ch;
+	}
+}
+
+/*
+ * Computes the suffix that every string accepted from each of the
+ * nodes lo.. must end with: the common suffix of the refs of the
+ * finals that the node reaches. This is a fixpoint, found by
+ * narrowing the suffixes backwards from the finals. The nodes lo..
+ * must not lead to nodes before lo.
+ * @param suf  the suffix of each node, set from node lo on
+ * @param lo   the first node
+ */
+static void
+nfa_node_suffixes_from(const struct globs *globs, const struct nfa *nfa,
+		       struct suffix *suf, unsigned lo)
+{
+	const unsigned nnodes = nfa->nnodes;
+	unsigned char *queued = calloc(nnodes - lo + 1, sizeof *queued);
+	unsigned *first, *pred, *queue;
+	unsigned i, j, n, qlen;
+
+	pred = nfa_preds(nfa, lo, &first);
+	queue = malloc((nnodes - lo + 1) * sizeof *queue);
+	qlen = 0;
+	for (i = lo; i < nnodes; ++i) {
+		const struct node *node = &nfa->nodes[i];
+		suf[i].len = SUFFIX_NONE;
+		for (j = 0; j < node->nfinals; ++j)
+			suffix_meet(&suf[i],
+				&refseq_find(globs, node->finals[j])->suffix);
+		if (node->nfinals) {
+			queued[i - lo] = 1;
+			queue[qlen++] = i;
+		}
+	}
+	while (qlen) {
+		n = queue[--qlen];
+		queued[n - lo] = 0;
+		for (j = n > lo ? first[n - lo - 1] : 0; j < first[n - lo];
+		     ++j) {
+			i = pred[j];
+			if (suffix_meet(&suf[i], &suf[n]) && !queued[i - lo]) {
+				queued[i - lo] = 1;
+				queue[qlen++] = i;
+			}
+		}
+	}
+	free(queue);
+	free(pred);
+	free(first);
+	free(queued);
+}
+
+/* Recomputes the required suffixes of the compiled globs' nodes */
+static void
+globs_set_suffixes(struct globs *globs)
+{
+	const struct nfa *nfa = &globs->dfa;
+
+	free(globs->nodesuffix);
+	globs->nodesuffix = malloc((nfa->nnodes + 1) *
+				   sizeof *globs->nodesuffix);
+	nfa_node_suffixes_from(globs, nfa, globs->nodesuffix, 0);
+}
+
+/*
+ * Computes the required suffixes of the nodes of a glob added after
+ * compilation, from node first on, and narrows the initial node's
+ * suffix to take in the new glob.
+ */
+static void
+globs_add_suffixes(struct globs *globs, unsigned first)
+{
+	const struct nfa *nfa = &globs->dfa;
+	const struct node *n0 = &nfa->nodes[0];
+	struct suffix *suf;
+	unsigned j;
+
+	suf = globs->nodesuffix = realloc(globs->nodesuffix,
+		(nfa->nnodes + 1) * sizeof *globs->nodesuffix);
+	nfa_node_suffixes_from(globs, nfa, suf, first);
+	/* (The new edges from node 0 are its last) */
+	for (j = n0->nedges; j-- && n0->edges[j].dest >= first; )
+		suffix_meet(&suf[0], &suf[n0->edges[j].dest]);
+}
+
+/*------------------------------------------------------------
+ * Literal globs
+ */
+
+/* Tests if a glob has no special characters, so matches only itself */
+static int
+glob_is_literal(const str *globstr)
+{
+	stri i;
+
+	for (i = stri_str(globstr); stri_more(i); stri_inc(i))
+		switch (stri_at(i)) {
+		case '?': case '*': case '[': case '\\':
+		case '(': case ')': case '|':
+			return 0;
+		}
+	return 1;
+}
+
+/* Hashes a ref pointer */
+static unsigned
+ref_hash(const void *ref)
+{
+	return (unsigned)((unsigned long)ref >> 3) * 2654435761u;
+}
+
+/*
+ * Records the seq of the first glob to have a ref, and narrows the
+ * ref's required suffix to that of the glob.
+ * @returns non-zero if the suffix of a ref already added was narrowed
+ */
+static int
+refseq_add(struct globs *globs, const void *ref, unsigned seq,
+	   const str *globstr)
+{
+	struct suffix suf;
+	struct refseq *old = globs->refseq;
+	unsigned oldsz = globs->refseqsz;
+	unsigned h, i;
+
+	if (2 * (globs->nrefseqs + 1) > globs->refseqsz) {
+		globs->refseqsz = oldsz ? 2 * oldsz : 16;
+		globs->refseq = calloc(globs->refseqsz, sizeof *globs->refseq);
+		for (i = 0; i < oldsz; ++i) {
+			if (!old[i].ref)
+				continue;
+			h = ref_hash(old[i].ref);
+			while (globs->refseq[h & (globs->refseqsz - 1)].ref)
+				h++;
+			globs->refseq[h & (globs->refseqsz - 1)] = old[i];
+		}
+		free(old);
+	}
+	glob_suffix(globstr, &suf);
+	for (h = ref_hash(ref); globs->refseq[h & (globs->refseqsz - 1)].ref;
+	     h++)
+		if (globs->refseq[h & (globs->refseqsz - 1)].ref == ref)
+			return suffix_meet(&globs->refseq[h &
+					(globs->refseqsz - 1)].suffix, &suf);
+	globs->refseq[h & (globs->refseqsz - 1)].ref = ref;
+	globs->refseq[h & (globs->refseqsz - 1)].seq = seq;
+	globs->refseq[h & (globs->refseqsz - 1)].suffix = suf;
+	globs->nrefseqs++;
+	return 0;
+}
+
+/* Finds the entry of a ref added to the globs */
+static const struct refseq *
+refseq_find(const struct globs *globs, const void *ref)
+{
+	unsigned h;
+
+	for (h = ref_hash(ref);
+	     globs->refseq[h & (globs->refseqsz - 1)].ref != ref; h++)
+		;
+	return &globs->refseq[h & (globs->refseqsz - 1)];
+}
+
+/* Returns the seq of the first glob with a ref */
+static unsigned
+refseq_get(const struct globs *globs, const void *ref)
+{
+	return refseq_find(globs, ref)->seq;
+}
+
+/*
+ * Removes the literals' edges from NFA node 0, so that subset
+ * construction does not see them.
+ */
+static void
+literals_detach(struct globs *globs)
+{
+	struct node *n = &globs->dfa.nodes[0];
+	unsigned i, j, k;
+
+	for (i = j = k = 0; i < n->nedges; ++i) {
+		if (k < globs->nliterals && globs->literal[k].edge == i) {
+			k++;
+			continue;
+		}
+		n->edges[j++] = n->edges[i];
+	}
+	n->nedges = j;
+}
+
+/* Working storage for inserting literals into a DFA */
+struct literal_inserter {
+	struct globs *globs;
+	unsigned *indeg;	/* number of edges entering each state */
+	unsigned capacity;	/* of indeg[] */
+};
+
+/* Adds a new, empty state to the DFA */
+static unsigned
+inserter_new_state(struct literal_inserter *li)
+{
+	unsigned s = nfa_new_node(&li->globs->dfa);
+
+	if (s == li->capacity) {
+		li->capacity *= 2;
+		li->indeg = realloc(li->indeg,
+			li->capacity * sizeof *li->indeg);
+	}
+	li->indeg[s] = 0;
+	return s;
+}
+
+/* Adds a new state with the same edges and finals as state d */
+static unsigned
+inserter_clone(struct literal_inserter *li, unsigned d)
+{
+	struct nfa *dfa = &li->globs->dfa;
+	unsigned t = inserter_new_state(li);
+	unsigned j;
+
+	for (j = 0; j < dfa->nodes[d].nedges; ++j) {
+		const struct edge *e = &dfa->nodes[d].edges[j];
+		cclass *cc = cclass_ref(e->cclass);
+		unsigned dest = e->dest;
+
+		nfa_new_edge(dfa, t, dest)->cclass = cc;
+		li->indeg[dest]++;
+	}
+	for (j = 0; j < dfa->nodes[d].nfinals; ++j)
+		nfa_add_final(dfa, t, dfa->nodes[d].finals[j]);
+	return t;
+}
+
+/* Returns the interned cclass of cc's characters other than ch */
+static cclass *
+cclass_without(const cclass *cc, unsigned ch)
+{
+	struct cclass_builder b;
+	cclass *result;
+	unsigned i;
+
+	cclass_builder_init(&b);
+	for (i = 0; i < cc->nintervals; ++i) {
+		unsigned lo = cc->interval[i].lo, hi = cc->interval[i].hi;
+		if (lo <= ch && ch < hi) {
+			cclass_builder_add(&b, lo, ch);
+			cclass_builder_add(&b, ch + 1, hi);
+		} else
+			cclass_builder_add(&b, lo, hi);
+	}
+	result = cclass_builder_finish(&b);
+	cclass_builder_fini(&b);
+	return cclass_intern(result);
+}
+
+/* Returns the interned cclass of a single character */
+static cclass *
+cclass_char(unsigned ch)
+{
+	cclass *cc = cclass_new();
+
+	cclass_add(cc, ch, ch + 1);
+	return cclass_intern(cc);
+}
+
+/*
+ * Inserts a literal into the DFA, so that the DFA also accepts the
+ * literal's string.  This is the product of the DFA with the
+ * literal's chain of characters: the states along the literal's path
+ * are cloned, unless they are only reached by the literal's prefix.
+ * The states so reached form a trie, shared by all the literals.
+ * Requires that nothing enters state 0.
+ */
+static void
+inserter_add(struct literal_inserter *li, const struct literal *lit)
+{
+	struct nfa *dfa = &li->globs->dfa;
+	unsigned cur = 0, ch, d, j, t, seq;
+	struct node *n;
+	stri i;
+
+	for (i = stri_str(lit->str); stri_more(i); cur = t) {
+		ch = stri_utf8_inc(&i);
+		n = &dfa->nodes[cur];
+		for (j = 0; j < n->nedges; ++j)
+			if (cclass_contains_ch(n->edges[j].cclass, ch))
+				break;
+		if (j == n->nedges) {
+			t = inserter_new_state(li);
+			nfa_new_edge(dfa, cur, t)->cclass = cclass_char(ch);
+			li->indeg[t]++;
+			continue;
+		}
+		d = n->edges[j].dest;
+		if (cclass_is_single(n->edges[j].cclass) && li->indeg[d] == 1) {
+			t = d;	/* already only reached by this prefix */
+			continue;
+		}
+		t = inserter_clone(li, d);
+		n = &dfa->nodes[cur];
+		if (cclass_is_single(n->edges[j].cclass)) {
+			n->edges[j].dest = t;
+			li->indeg[d]--;
+		} else {
+			cclass *rest = cclass_without(n->edges[j].cclass, ch);
+			cclass_free(n->edges[j].cclass);
+			n->edges[j].cclass = rest;
+			nfa_new_edge(dfa, cur, t)->cclass = cclass_char(ch);
+		}
+		li->indeg[t]++;
+	}
+
+	/* Insert the ref in order of the globs' seq */
+	nfa_add_final(dfa, cur, lit->ref);
+	n = &dfa->nodes[cur];
+	seq = lit->seq;
+	for (j = n->nfinals - 1; j > 0; --j) {
+		const void *prev = n->finals[j - 1];
+		if (prev == lit->ref || refseq_get(li->globs, prev) < seq)
+			break;
+		n->finals[j] = prev;
+		n->finals[j - 1] = lit->ref;
+	}
+}
+
+/*
+ * Inserts the literals, which #literals_detach() left out, into the
+ * DFA.
+ */
+static void
+literals_insert(struct globs *globs)
+{
+	struct nfa *dfa = &globs->dfa;
+	struct literal_inserter li;
+	unsigned s, j;
+
+	li.globs = globs;
+	li.capacity = 2 * dfa->nnodes + 16;
+	li.indeg = calloc(li.capacity, sizeof *li.indeg);
+	for (s = 0; s < dfa->nnodes; ++s)
+		for (j = 0; j < dfa->nodes[s].nedges; ++j)
+			li.indeg[dfa->nodes[s].edges[j].dest]++;
+
+	/* No NFA edge enters the start node, so no DFA edge enters
+	 * state 0, and the literals can modify it in place */
+	assert(!li.indeg[0]);
+
+	for (s = 0; s < globs->nliterals; ++s) {
+		inserter_add(&li, &globs->literal[s]);
+		str_free(globs->literal[s].str);
+	}
+	globs->nliterals = 0;
+	free(li.indeg);
+	nfa_freeze(dfa);
+}
+
+/*------------------------------------------------------------
+ * UTF-8 byte automaton construction
+ */
+
+/* Working storage for constructing the byte automaton */
+struct bytes_builder {
+	struct globs *globs;
+	unsigned capacity;	/* rows allocated in globs->bytes */
+	unsigned hashsz;	/* (a power of 2) */
+	unsigned *hash;		/* shared row indicies, or NOSTATE */
+	unsigned *chain;	/* [dest * 3 + level - 1] -> bytes_chain() */
+};
+
+/* Hashes a byte automaton row */
+static unsigned
+row_hash(const unsigned *row)
+{
+	return column_hash(row, 256);
+}
+
+/*
+ * Finds or adds a shared row to the byte automaton.
+ * @returns the index of the stored row
+ */
+static unsigned
+bytes_intern(struct bytes_builder *b, const unsigned *row)
+{
+	struct globs *globs = b->globs;
+	unsigned h, r, i;
+
+	if (2 * (globs->nbyterows - globs->nstates + 1) > b->hashsz) {
+		/* rehash */
+		free(b->hash);
+		b->hashsz *= 2;
+		b->hash = malloc(b->hashsz * sizeof *b->hash);
+		for (i = 0; i < b->hashsz; ++i)
+			b->hash[i] = NOSTATE;
+		for (r = globs->nstates; r < globs->nbyterows; ++r) {
+			h = row_hash(&globs->bytes[r * 256]);
+			while (b->hash[h & (b->hashsz - 1)] != NOSTATE)
+				h++;
+			b->hash[h & (b->hashsz - 1)] = r;
+		}
+	}
+	h = row_hash(row);
+	while ((r = b->hash[h & (b->hashsz - 1)]) != NOSTATE) {
+		if (memcmp(&globs->bytes[r * 256], row, 256 * sizeof *row) == 0)
+			return r;
+		h++;
+	}
+	if (globs->nbyterows == b->capacity) {
+		b->capacity *= 2;
+		globs->bytes = realloc(globs->bytes,
+			b->capacity * 256 * sizeof *globs->bytes);
+	}
+	r = globs->nbyterows++;
+	memcpy(&globs->bytes[r * 256], row, 256 * sizeof *row);
+	b->hash[h & (b->hashsz - 1)] = r;
+	return r;
+}
+
+/*
+ * Tests if state s makes the same transition for every character
+ * in [lo,hi).
+ * @returns the common next state (or NOSTATE), or BYTE_FALLBACK
+ *          if the transitions differ
+ */
+static unsigned
+uniform_dest(const struct globs *globs, unsigned s, unsigned lo, unsigned hi)
+{
+	const unsigned *trans = &globs->trans[s * globs->nclasses];
+	unsigned j = bound_index(globs->bound, globs->nbounds, lo);
+	unsigned dest = trans[globs->boundclass[j]];
+
+	for (j++; globs->bound[j] < hi; j++)
+		if (trans[globs->boundclass[j]] != dest)
+			return BYTE_FALLBACK;
+	return dest;
+}
+
+/*
+ * Returns the entry for a shared chain of rows that consumes
+ * the remaining continuation bytes of a character, and
+ * then transitions to dest.
+ */
+static unsigned
+bytes_chain(struct bytes_builder *b, unsigned dest, unsigned level)
+{
+	unsigned *memo = &b->chain[3 * (dest == NOSTATE ? b->globs->nstates
+							: dest)];
+	unsigned row[256];
+	unsigned c;
+
+	if (!memo[level - 1]) {
+		for (c = 0; c < 256; ++c)
+			row[c] = BYTE_FALLBACK;
+		for (c = 0x80; c < 0xc0; ++c)
+			row[c] = level == 1 ? dest
+					    : bytes_chain(b, dest, level - 1);
+		memo[level - 1] = BYTE_MORE | bytes_intern(b, row);
+	}
+	return memo[level - 1];
+}
+
+/*
+ * Builds the entry for the continuation bytes of characters in the
+ * range [base, base + 64^level), with all characters below minvalid
+ * being invalid (overlong).
+ * @returns the entry that refers to the row
+ */
+static unsigned
+bytes_build(struct bytes_builder *b, unsigned s, unsigned base,
+	    unsigned level, unsigned minvalid)
+{
+	const struct globs *globs = b->globs;
+	const unsigned span = 1u << (6 * (level - 1));
+	const unsigned end = base + 64 * span;
+	unsigned row[256];
+	unsigned c, dest;
+
+	/* Ranges of valid characters that all go to the same state
+	 * only need their bytes consumed */
+	if (base >= minvalid && end <= MAXCHAR &&
+	    (end <= 0xd800 || base >= 0xe000))
+	{
+		dest = uniform_dest(globs, s, base, end);
+		if (dest != BYTE_FALLBACK)
+			return bytes_chain(b, dest, level);
+	}
+
+	for (c = 0; c < 256; ++c)
+		row[c] = BYTE_FALLBACK;
+	for (c = 0; c < 64; ++c) {
+		unsigned lo = base + c * span;
+		unsigned hi = lo + span;
+
+		if (hi <= minvalid || lo >= MAXCHAR ||
+		    (lo >= 0xd800 && hi <= 0xe000))
+			continue;	/* invalid UTF-8 */
+		if (level == 1)
+			row[0x80 | c] = globs->trans[s * globs->nclasses +
+						     globs_class(globs, lo)];
+		else
+			row[0x80 | c] = bytes_build(b, s, lo, level - 1,
+						    minvalid);
+	}
+	return BYTE_MORE | bytes_intern(b, row);
+}
+
+/*
+ * Lowers the tabulated character automaton into a UTF-8 byte automaton.
+ * Must be called after #globs_tabulate().
+ */
+static void
+globs_lower_bytes(struct globs *globs)
+{
+	struct bytes_builder b;
+	unsigned s, c, i;
+
+	b.globs = globs;
+	b.capacity = 2 * globs->nstates + 16;
+	b.hashsz = 64;
+	b.hash = malloc(b.hashsz * sizeof *b.hash);
+	for (i = 0; i < b.hashsz; ++i)
+		b.hash[i] = NOSTATE;
+	b.chain = calloc(3 * (globs->nstates + 1), sizeof *b.chain);
+	globs->bytes = malloc(b.capacity * 256 * sizeof *globs->bytes);
+	globs->nbyterows = globs->nstates;
+
+	for (s = 0; s < globs->nstates; ++s) {
+		unsigned row[256];
+		for (c = 0; c < 0x80; ++c)
+			row[c] = globs->trans[s * globs->nclasses +
+					      globs->lowclass[c]];
+		for (; c < 0xc2; ++c)
+			row[c] = BYTE_FALLBACK;	/* stray or overlong */
+		for (; c < 0xe0; ++c)
+			row[c] = bytes_build(&b, s, (c & 0x1f) << 6, 1, 0x80);
+		for (; c < 0xf0; ++c)
+			row[c] = bytes_build(&b, s, (c & 0x0f) << 12, 2, 0x800);
+		for (; c < 0xf5; ++c)
+			row[c] = bytes_build(&b, s, (c & 0x07) << 18, 3,
+					     0x10000);
+		for (; c < 0x100; ++c)
+			row[c] = BYTE_FALLBACK;
+		/* (bytes_build may have moved globs->bytes) */
+		memcpy(&globs->bytes[s * 256], row, sizeof row);
+	}
+	free(b.chain);
+	free(b.hash);
+	globs->bytes = realloc(globs->bytes,
+		globs->nbyterows * 256 * sizeof *globs->bytes);
+}
+
+/*------------------------------------------------------------
+ * Lazy DFA construction
+ */
+
+static void
+lazy_free(struct lazy *lazy)
+{
+	unsigned i;
+
+	if (!lazy)
+		return;
+	for (i = 0; i < lazy->nstates; ++i) {
+		bitset_free(lazy->set[i]);
+		free(lazy->row[i]);
+		free(lazy->refs[i]);
+	}
+	free(lazy->set);
+	free(lazy->nrefs);
+	free(lazy->refs);
+	free(lazy->flags);
+	free(lazy->nodeflags);
+	free(lazy->row);
+	free(lazy->rowlen);
+	free(lazy->hash);
+	free(lazy->classlo);
+	free(lazy);
+}
+
+/*
+ * Appends a node's final refs to an array of refs,
+ * omitting those already present.
+ * @returns the reallocated array
+ */
+static const void **
+refs_merge(const void **refs, unsigned *nrefs, const struct node *node)
+{
+	unsigned i, j;
+
+	for (i = 0; i < node->nfinals; ++i) {
+		for (j = 0; j < *nrefs; ++j)
+			if (refs[j] == node->finals[i])
+				break;
+		if (j < *nrefs)
+			continue;
+		refs = realloc(refs, (*nrefs + 1) * sizeof *refs);
+		refs[(*nrefs)++] = node->finals[i];
+	}
+	return refs;
+}
+
+/* Stores the final refs of the nodes of state s, in node order */
+static void
+lazy_set_refs(const struct nfa *nfa, struct lazy *lazy, unsigned s)
+{
+	unsigned i;
+
+	free(lazy->refs[s]);
+	lazy->refs[s] = 0;
+	lazy->nrefs[s] = 0;
+	bitset_for(i, lazy->set[s])
+		lazy->refs[s] = refs_merge(lazy->refs[s], &lazy->nrefs[s],
+					   &nfa->nodes[i]);
+}
+
+/* Returns the GLOBS_STATE_* flags of a set of nodes */
+static unsigned char
+lazy_flags(const struct lazy *lazy, const bitset *set)
+{
+	unsigned char flags = GLOBS_STATE_DEAD;
+	unsigned i;
+
+	bitset_for(i, set) {
+		if (lazy->nodeflags[i] & NODE_LIVE)
+			flags &= ~GLOBS_STATE_DEAD;
+		if (lazy->nodeflags[i] & NODE_MORE)
+			return GLOBS_STATE_MORE;
+	}
+	return flags;
+}
+
+/* Rebuilds the hash table of state sets */
+static void
+lazy_rehash(struct lazy *lazy)
+{
+	unsigned h, i;
+
+	free(lazy->hash);
+	lazy->hash = malloc(lazy->hashsz * sizeof *lazy->hash);
+	for (i = 0; i < lazy->hashsz; ++i)
+		lazy->hash[i] = NOSTATE;
+	for (i = 0; i < lazy->nstates; ++i) {
+		h = bitset_hash(lazy->set[i]);
+		while (lazy->hash[h & (lazy->hashsz - 1)] != NOSTATE)
+			h++;
+		lazy->hash[h & (lazy->hashsz - 1)] = i;
+	}
+}
+
+/*
+ * Finds or adds the state for a set of NFA nodes.
+ * @returns the state index
+ */
+static unsigned
+lazy_intern(const struct globs *globs, const bitset *set)
+{
+	struct lazy *lazy = globs->lazy;
+	unsigned h, i, n;
+
+	h = bitset_hash(set);
+	while ((i = lazy->hash[h & (lazy->hashsz - 1)]) != NOSTATE) {
+		if (bitset_cmp(lazy->set[i], set) == 0)
+			return i;
+		h++;
+	}
+
+	n = lazy->nstates++;
+	if (n == lazy->capacity) {
+		lazy->capacity = lazy->capacity ? 2 * lazy->capacity : 16;
+		lazy->set = realloc(lazy->set,
+			lazy->capacity * sizeof *lazy->set);
+		lazy->nrefs = realloc(lazy->nrefs,
+			lazy->capacity * sizeof *lazy->nrefs);
+		lazy->refs = realloc(lazy->refs,
+			lazy->capacity * sizeof *lazy->refs);
+		lazy->flags = realloc(lazy->flags,
+			lazy->capacity * sizeof *lazy->flags);
+		lazy->row = realloc(lazy->row,
+			lazy->capacity * sizeof *lazy->row);
+		lazy->rowlen = realloc(lazy->rowlen,
+			lazy->capacity * sizeof *lazy->rowlen);
+	}
+	lazy->set[n] = bitset_dup(set);
+	lazy->row[n] = 0;
+	lazy->rowlen[n] = 0;
+	lazy->refs[n] = 0;
+	lazy_set_refs(&globs->dfa, lazy, n);
+	lazy->flags[n] = lazy_flags(lazy, set);
+	lazy->hash[h & (lazy->hashsz - 1)] = n;
+
+	if (2 * lazy->nstates > lazy->hashsz) {
+		lazy->hashsz *= 2;
+		lazy_rehash(lazy);
+	}
+	return n;
+}
+
+/*
+ * Computes the transition from state s on characters of class c,
+ * by simulating the NFA.
+ */
+static unsigned
+lazy_compute(const struct globs *globs, unsigned s, unsigned c)
+{
+	const struct lazy *lazy = globs->lazy;
+	const struct nfa *nfa = &globs->dfa;
+	const unsigned ch = lazy->classlo[c];
+	bitset *dest = bitset_alloca(lazy->nbits);
+	unsigned ni, j;
+
+	bitset_for(ni, lazy->set[s]) {
+		const struct node *n = &nfa->nodes[ni];
+		for (j = 0; j < n->nedges; ++j)
+			if (n->edges[j].cclass &&
+			    cclass_contains_ch(n->edges[j].cclass, ch))
+				bitset_insert(dest, n->edges[j].dest);
+	}
+	if (bitset_is_empty(dest))
+		return NOSTATE;
+	epsilon_closure(nfa, dest);
+	return lazy_intern(globs, dest);
+}
+
+/* Discards the cached row of state s */
+static void
+lazy_drop_row(struct lazy *lazy, unsigned s)
+{
+	lazy->cache_used -= lazy->rowlen[s] * sizeof (unsigned);
+	free(lazy->row[s]);
+	lazy->row[s] = 0;
+	lazy->rowlen[s] = 0;
+}
+
+/*
+ * Returns the (possibly new, or extended) row of cached transitions
+ * for state s, covering all the classes.
+ * Flushes the cache if the row would exceed the cache limit.
+ */
+static unsigned *
+lazy_row(const struct globs *globs, unsigned s)
+{
+	struct lazy *lazy = globs->lazy;
+	const unsigned extra = (globs->nclasses - lazy->rowlen[s]) *
+			       sizeof (unsigned);
+	unsigned i;
+
+	if (lazy->rowlen[s] < globs->nclasses) {
+		if (lazy->cache_used + extra > globs->cache_limit) {
+			for (i = 0; i < lazy->nstates; ++i)
+				lazy_drop_row(lazy, i);
+		}
+		lazy->row[s] = realloc(lazy->row[s],
+			globs->nclasses * sizeof *lazy->row[s]);
+		for (i = lazy->rowlen[s]; i < globs->nclasses; ++i)
+			lazy->row[s][i] = LAZY_UNKNOWN;
+		lazy->row[s][0] = NOSTATE;
+		lazy->cache_used += (globs->nclasses - lazy->rowlen[s]) *
+				    sizeof (unsigned);
+		lazy->rowlen[s] = globs->nclasses;
+	}
+	return lazy->row[s];
+}
+
+/* Steps a GLOBS_LAZY automaton */
+static int
+lazy_step(const struct globs *globs, unsigned c, unsigned *statep)
+{
+	const struct lazy *lazy = globs->lazy;
+	unsigned *row = lazy->row[*statep];
+	unsigned next = c < lazy->rowlen[*statep] ? row[c] : LAZY_UNKNOWN;
+
+	if (next == LAZY_UNKNOWN) {
+		next = lazy_compute(globs, *statep, c);
+		/* (computing may have added states, so fetch the row
+		 *  only now) */
+		lazy_row(globs, *statep)[c] = next;
+	}
+	if (next == NOSTATE)
+		return 0;
+	*statep = next;
+	return 1;
+}
+
+/* Allocates the globs' empty lazy state storage */
+static struct lazy *
+lazy_new(struct globs *globs)
+{
+	struct lazy *lazy;
+	unsigned i;
+
+	lazy = globs->lazy = malloc(sizeof *lazy);
+	lazy->nstates = 0;
+	lazy->capacity = 0;
+	lazy->nbits = globs->dfa.nnodes;
+	lazy->set = 0;
+	lazy->nrefs = 0;
+	lazy->refs = 0;
+	lazy->flags = 0;
+	lazy->nodeflags = nfa_node_flags(&globs->dfa);
+	lazy->row = 0;
+	lazy->rowlen = 0;
+	lazy->hashsz = 16;
+	lazy->hash = malloc(lazy->hashsz * sizeof *lazy->hash);
+	for (i = 0; i < lazy->hashsz; ++i)
+		lazy->hash[i] = NOSTATE;
+	lazy->classlo = 0;
+	lazy->cache_used = 0;
+	return lazy;
+}
+
+/*
+ * Computes the alphabet classes of the NFA: the elementary intervals
+ * of its edges, except that the characters on no edge are all in
+ * class 0.
+ *
+ * @returns the lowest character of each class (MAXCHAR for class 0)
+ */
+static unsigned *
+globs_nfa_classes(struct globs *globs)
+{
+	const struct nfa *nfa = &globs->dfa;
+	unsigned nbreaks, e, i, j, s;
+	unsigned *breaks, *elemclass, *classlo;
+
+	/* Find which elementary intervals are on some edge */
+	breaks = edge_breaks(nfa, &nbreaks);
+	elemclass = calloc(nbreaks - 1, sizeof *elemclass);
+	for (s = 0; s < nfa->nnodes; ++s) {
+		const struct node *n = &nfa->nodes[s];
+		for (j = 0; j < n->nedges; ++j) {
+			const cclass *cc = n->edges[j].cclass;
+			if (!cc)
+				continue;
+			for (i = 0; i < cc->nintervals; ++i) {
+				e = bound_index(breaks, nbreaks,
+						cc->interval[i].lo);
+				for (; breaks[e] < cc->interval[i].hi; ++e)
+					elemclass[e] = 1;
+			}
+		}
+	}
+	classlo = malloc(nbreaks * sizeof *classlo);
+	classlo[0] = MAXCHAR;
+	globs->nclasses = 1;
+	for (e = 0; e + 1 < nbreaks; ++e) {
+		if (elemclass[e]) {
+			classlo[globs->nclasses] = breaks[e];
+			elemclass[e] = globs->nclasses++;
+		}
+	}
+	globs_set_classes(globs, breaks, nbreaks, elemclass);
+	free(elemclass);
+	free(breaks);
+	return classlo;
+}
+
+/*
+ * Prepares the globs for lazy DFA construction,
+ * with the classes of #globs_nfa_classes().
+ */
+static void
+globs_lazy(struct globs *globs)
+{
+	const struct nfa *nfa = &globs->dfa;
+	struct lazy *lazy = lazy_new(globs);
+	bitset *initial;
+
+	lazy->classlo = globs_nfa_classes(globs);
+
+	/* The initial state 0 is the closure of NFA node 0 */
+	initial = bitset_alloca(nfa->nnodes);
+	if (nfa->nnodes)
+		bitset_insert(initial, 0);
+	epsilon_closure(nfa, initial);
+	lazy_intern(globs, initial);
+}
+
+/*
+ * Recomputes the lowest character of each lazy class, and the low
+ * character map, after the class bounds have changed.
+ */
+static void
+lazy_reclass(struct globs *globs)
+{
+	struct lazy *lazy = globs->lazy;
+	unsigned i, j;
+
+	lazy->classlo = realloc(lazy->classlo,
+		globs->nclasses * sizeof *lazy->classlo);
+	for (i = 0; i < globs->nclasses; ++i)
+		lazy->classlo[i] = NOSTATE;	/* (unused class) */
+	lazy->classlo[0] = MAXCHAR;
+	for (j = 0; j + 1 < globs->nbounds; ++j)
+		if (lazy->classlo[globs->boundclass[j]] == NOSTATE)
+			lazy->classlo[globs->boundclass[j]] = globs->bound[j];
+	for (i = j = 0; i < NLOWCLASS; ++i) {
+		while (globs->bound[j + 1] <= i)
+			j++;
+		globs->lowclass[i] = globs->boundclass[j];
+	}
+}
+
+/* Ensures that ch is one of the class bounds */
+static void
+lazy_split(struct globs *globs, unsigned ch)
+{
+	unsigned j = bound_index(globs->bound, globs->nbounds, ch);
+
+	if (ch >= MAXCHAR || globs->bound[j] == ch)
+		return;
+	globs->bound = realloc(globs->bound,
+		(globs->nbounds + 1) * sizeof *globs->bound);
+	globs->boundclass = realloc(globs->boundclass,
+		globs->nbounds * sizeof *globs->boundclass);
+	memmove(&globs->bound[j + 2], &globs->bound[j + 1],
+		(globs->nbounds - j - 1) * sizeof *globs->bound);
+	memmove(&globs->boundclass[j + 2], &globs->boundclass[j + 1],
+		(globs->nbounds - j - 2) * sizeof *globs->boundclass);
+	globs->bound[j + 1] = ch;
+	globs->boundclass[j + 1] = globs->boundclass[j];
+	globs->nbounds++;
+}
+
+/*
+ * Refines the lazy classes so that each is either wholly inside or
+ * wholly outside a new edge's cclass.  The part of a class that the
+ * cclass covers is given a new class number, unless it is the whole
+ * class.  Class 0 is always renumbered, as it must remain on no edge.
+ * (lazy_reclass() must be called after refinement.)
+ */
+static void
+lazy_refine(struct globs *globs, const cclass *cc)
+{
+	const unsigned nclasses = globs->nclasses;
+	unsigned *total, *covered, *remap;
+	unsigned i, j, c;
+
+	for (i = 0; i < cc->nintervals; ++i) {
+		lazy_split(globs, cc->interval[i].lo);
+		lazy_split(globs, cc->interval[i].hi);
+	}
+	total = calloc(3 * nclasses, sizeof *total);
+	covered = total + nclasses;
+	remap = covered + nclasses;
+	for (j = 0; j + 1 < globs->nbounds; ++j) {
+		c = globs->boundclass[j];
+		total[c]++;
+		if (cclass_contains_ch(cc, globs->bound[j]))
+			covered[c]++;
+	}
+	for (j = 0; j + 1 < globs->nbounds; ++j) {
+		c = globs->boundclass[j];
+		if (!cclass_contains_ch(cc, globs->bound[j]) ||
+		    (c && covered[c] == total[c]))
+			continue;
+		if (!remap[c])
+			remap[c] = globs->nclasses++;
+		globs->boundclass[j] = remap[c];
+	}
+	free(total);
+}
+
+/*
+ * Converts compiled (eager) globs into lazy globs, so that more
+ * globs can be added to them.
+ * The DFA nodes are shifted up by one to make room for a new initial
+ * node 0 with an epsilon edge to the DFA's initial node.  Each DFA
+ * state s then becomes the lazy state for the set {s+1}, keeping its
+ * number, and the tabulated rows are carried over into the cache.
+ */
+static void
+globs_thaw(struct globs *globs)
+{
+	struct nfa *nfa = &globs->dfa;
+	const unsigned n = nfa->nnodes;
+	struct lazy *lazy;
+	unsigned s, j, c;
+	bitset *set;
+
+	nfa_new_node(nfa);
+	memmove(&nfa->nodes[1], &nfa->nodes[0], n * sizeof *nfa->nodes);
+	memset(&nfa->nodes[0], 0, sizeof *nfa->nodes);
+	for (s = 1; s <= n; ++s)
+		for (j = 0; j < nfa->nodes[s].nedges; ++j)
+			nfa->nodes[s].edges[j].dest++;
+	if (n)
+		nfa_new_edge(nfa, 0, 1);
+
+	lazy = lazy_new(globs);
+	lazy_reclass(globs);
+	set = bitset_alloca(lazy->nbits);
+	bitset_insert(set, 0);
+	if (n)
+		bitset_insert(set, 1);
+	lazy_intern(globs, set);
+	for (s = 1; s < n; ++s) {
+		bitset_clear(set);
+		bitset_insert(set, s + 1);
+		lazy_intern(globs, set);
+	}
+
+	/* The transitions into DFA state 0 are not carried over, as
+	 * lazy state 0 now also includes the new globs */
+	for (s = 1; s < n; ++s) {
+		const unsigned *trans = &globs->trans[s * globs->nclasses];
+		unsigned *row;
+
+		if (lazy->cache_used + globs->nclasses * sizeof *row >
+		    globs->cache_limit)
+			break;
+		row = lazy_row(globs, s);
+		for (c = 1; c < globs->nclasses; ++c)
+			row[c] = trans[c] ? trans[c] : LAZY_UNKNOWN;
+	}
+
+	free(globs->trans);
+	globs->trans = 0;
+	free(globs->stateflags);
+	globs->stateflags = 0;
+	free(globs->bytes);
+	globs->bytes = 0;
+	globs->nbyterows = 0;
+}
+
+/*
+ * Extends lazy globs with a glob just added to the NFA.
+ *
+ * @param first  the first NFA node of the new glob
+ * @param entry  the new glob's entry node
+ */
+static void
+lazy_add(struct globs *globs, unsigned first, unsigned entry)
+{
+	const struct nfa *nfa = &globs->dfa;
+	struct lazy *lazy = globs->lazy;
+	unsigned char flags;
+	unsigned s, j;
+	bitset *initial;
+
+	if (nfa->nnodes > lazy->nbits) {
+		lazy->nbits = 2 * lazy->nbits > nfa->nnodes ?
+			      2 * lazy->nbits : nfa->nnodes;
+		for (s = 0; s < lazy->nstates; ++s)
+			lazy->set[s] = bitset_resize(lazy->set[s],
+						     lazy->nbits);
+		lazy_rehash(lazy);
+	}
+
+	for (s = first; s < nfa->nnodes; ++s)
+		for (j = 0; j < nfa->nodes[s].nedges; ++j)
+			if (nfa->nodes[s].edges[j].cclass)
+				lazy_refine(globs,
+					    nfa->nodes[s].edges[j].cclass);
+	lazy_reclass(globs);
+
+	/* Only node 0 leads to the new glob, and nothing leads to
+	 * node 0, so state 0 is the only existing state to change.
+	 * (Its stale hash entry is harmless, as no other set can equal
+	 * it.) */
+	initial = bitset_alloca(lazy->nbits);
+	bitset_insert(initial, entry);
+	epsilon_closure(nfa, initial);
+	bitset_or_with(lazy->set[0], initial);
+	lazy->nodeflags = realloc(lazy->nodeflags,
+		(nfa->nnodes + 1) * sizeof *lazy->nodeflags);
+	nfa_node_flags_from(nfa, lazy->nodeflags, first);
+	/* (The new edges from node 0 are its last) */
+	for (j = nfa->nodes[0].nedges; j--; ) {
+		const struct edge *e = &nfa->nodes[0].edges[j];
+
+		if (e->dest < first)
+			break;
+		if (lazy->nodeflags[e->dest] & NODE_LIVE)
+			lazy->nodeflags[0] |= e->cclass ? NODE_LIVE | NODE_MORE
+							: NODE_LIVE;
+	}
+
+	/* The new nodes come after the old in node order, so their
+	 * refs and flags are merged into those of state 0 */
+	bitset_for(s, initial)
+		lazy->refs[0] = refs_merge(lazy->refs[0], &lazy->nrefs[0],
+					   &nfa->nodes[s]);
+	flags = lazy_flags(lazy, initial);
+	if ((lazy->flags[0] | flags) & GLOBS_STATE_MORE)
+		lazy->flags[0] = GLOBS_STATE_MORE;
+	else
+		lazy->flags[0] &= flags;
+	lazy_drop_row(lazy, 0);
+}
+
+/*------------------------------------------------------------
+ * Bit-parallel simulation of small NFAs
+ */
+
+static void
+bitsim_free(struct bitsim *bitsim)
+{
+	unsigned i;
+
+	if (!bitsim)
+		return;
+	for (i = 0; i < bitsim->refsetsz; ++i)
+		free(bitsim->refset[i].refs);
+	free(bitsim->refset);
+	free(bitsim->node);
+	free(bitsim->succ);
+	free(bitsim);
+}
+
+/* Returns the mask of the positions in the closure of an NFA node */
+static unsigned
+bitsim_closure(const struct nfa *nfa, const unsigned *pos, unsigned node)
+{
+	bitset *set = bitset_alloca(nfa->nnodes);
+	unsigned mask = 0;
+	unsigned i;
+
+	bitset_insert(set, node);
+	epsilon_closure(nfa, set);
+	bitset_for(i, set)
+		if (pos[i] != NOSTATE)
+			mask |= 1u << pos[i];
+	return mask;
+}
+
+/*
+ * Prepares the globs for bit-parallel simulation, if the NFA
+ * is small enough.
+ * @returns 0 if the NFA has too many positions
+ */
+static int
+globs_bitsim(struct globs *globs)
+{
+	const struct nfa *nfa = &globs->dfa;
+	struct bitsim *b;
+	unsigned *pos, *closure, *classlo, *succ;
+	unsigned char *nodeflags;
+	unsigned npos, i, j, p, c, v;
+
+	/* Number the positions */
+	pos = malloc(nfa->nnodes * sizeof *pos);
+	npos = 0;
+	for (i = 0; i < nfa->nnodes; ++i) {
+		const struct node *n = &nfa->nodes[i];
+		pos[i] = NOSTATE;
+		for (j = 0; j < n->nedges; ++j)
+			if (n->edges[j].cclass)
+				break;
+		if (j < n->nedges || n->nfinals)
+			pos[i] = npos++;
+	}
+	if (!nfa->nnodes || npos > BITSIM_MAX) {
+		free(pos);
+		return 0;
+	}
+
+	b = globs->bitsim = malloc(sizeof *b);
+	b->npos = npos;
+	b->node = malloc(npos * sizeof *b->node);
+	b->final = 0;
+	b->nrefsets = 0;
+	b->refsetsz = 0;
+	b->refset = 0;
+	b->live = 0;
+	b->more = 0;
+	nodeflags = nfa_node_flags(nfa);
+	for (i = 0; i < nfa->nnodes; ++i) {
+		if (pos[i] == NOSTATE)
+			continue;
+		b->node[pos[i]] = i;
+		if (nfa->nodes[i].nfinals)
+			b->final |= 1u << pos[i];
+		if (nodeflags[i] & NODE_LIVE)
+			b->live |= 1u << pos[i];
+		if (nodeflags[i] & NODE_MORE)
+			b->more |= 1u << pos[i];
+	}
+	free(nodeflags);
+	b->initial = bitsim_closure(nfa, pos, 0);
+
+	/* The closure of each node that an edge enters */
+	closure = malloc(nfa->nnodes * sizeof *closure);
+	for (i = 0; i < nfa->nnodes; ++i)
+		closure[i] = NOSTATE;
+	for (p = 0; p < npos; ++p) {
+		const struct node *n = &nfa->nodes[b->node[p]];
+		for (j = 0; j < n->nedges; ++j) {
+			unsigned d = n->edges[j].dest;
+			if (n->edges[j].cclass && closure[d] == NOSTATE)
+				closure[d] = bitsim_closure(nfa, pos, d);
+		}
+	}
+
+	/* Tabulate the successors of each position, then combine them
+	 * into the nibble tables */
+	classlo = globs_nfa_classes(globs);
+	b->ngroups = (npos + 3) / 4;
+	b->succ = calloc(globs->nclasses * b->ngroups * 16, sizeof *b->succ);
+	for (c = 1; c < globs->nclasses; ++c) {
+		succ = &b->succ[c * b->ngroups * 16];
+		for (p = 0; p < npos; ++p) {
+			const struct node *n = &nfa->nodes[b->node[p]];
+			unsigned mask = 0;
+			for (j = 0; j < n->nedges; ++j)
+				if (n->edges[j].cclass &&
+				    cclass_contains_ch(n->edges[j].cclass,
+						       classlo[c]))
+					mask |= closure[n->edges[j].dest];
+			succ[(p / 4) * 16 + (1u << (p % 4))] = mask;
+		}
+		for (i = 0; i < b->ngroups; ++i, succ += 16)
+			for (v = 3; v < 16; ++v)
+				if (v & (v - 1))
+					succ[v] = succ[v & (v - 1)] |
+						  succ[v & -v];
+	}
+	free(classlo);
+	free(closure);
+	free(pos);
+	return 1;
+}
+
+/* Steps a bitsim automaton */
+static int
+bitsim_step(const struct globs *globs, unsigned c, unsigned *statep)
+{
+	const struct bitsim *b = globs->bitsim;
+	const unsigned *succ = &b->succ[c * b->ngroups * 16];
+	unsigned mask = *statep ? *statep & ~BITSIM_STATE : b->initial;
+	unsigned next = 0;
+	unsigned i;
+
+	for (i = 0; i < b->ngroups; ++i, succ += 16, mask >>= 4)
+		next |= succ[mask & 15];
+	if (!next)
+		return 0;
+	*statep = BITSIM_STATE | next;
+	return 1;
+}
+
+/* Returns the ref of a bitsim state's first accepting position */
+static const void *
+bitsim_accept(const struct globs *globs, unsigned state)
+{
+	const struct bitsim *b = globs->bitsim;
+	unsigned mask = (state ? state & ~BITSIM_STATE : b->initial) &
+			b->final;
+
+	if (!mask)
+		return NULL;
+	return globs->dfa.nodes[b->node[__builtin_ctz(mask)]].finals[0];
+}
+
+/*
+ * Finds the final refs of a bitsim state. A state with more than one
+ * final position has them merged once, and kept in the refset table.
+ * The table is a cache that is filled as states are queried, so this
+ * modifies the globs; see globs_is_shareable().
+ */
+static const void * const *
+bitsim_refs(const struct globs *globs, unsigned state, unsigned *nrefs_return)
+{
+	struct bitsim *b = ((struct globs *)globs)->bitsim;
+	unsigned mask = (state ? state & ~BITSIM_STATE : b->initial) &
+			b->final;
+	const struct node *node;
+	struct bitsim_refs *r;
+	unsigned h, i;
+
+	if (!mask) {
+		*nrefs_return = 0;
+		return NULL;
+	}
+	if (!(mask & (mask - 1))) {
+		node = &globs->dfa.nodes[b->node[__builtin_ctz(mask)]];
+		*nrefs_return = node->nfinals;
+		return node->finals;
+	}
+
+	if (2 * (b->nrefsets + 1) > b->refsetsz) {
+		struct bitsim_refs *old = b->refset;
+		unsigned oldsz = b->refsetsz;
+
+		b->refsetsz = oldsz ? 2 * oldsz : 16;
+		b->refset = calloc(b->refsetsz, sizeof *b->refset);
+		for (i = 0; i < oldsz; ++i) {
+			if (!old[i].mask)
+				continue;
+			h = old[i].mask * 2654435761u;
+			while (b->refset[h & (b->refsetsz - 1)].mask)
+				h++;
+			b->refset[h & (b->refsetsz - 1)] = old[i];
+		}
+		free(old);
+	}
+	h = mask * 2654435761u;
+	while ((r = &b->refset[h & (b->refsetsz - 1)])->mask &&
+	       r->mask != mask)
+		h++;
+	if (!r->mask) {
+		r->mask = mask;
+		r->nrefs = 0;
+		r->refs = 0;
+		for (; mask; mask &= mask - 1)
+			r->refs = refs_merge(r->refs, &r->nrefs,
+			    &globs->dfa.nodes[b->node[__builtin_ctz(mask)]]);
+		b->nrefsets++;
+	}
+	*nrefs_return = r->nrefs;
+	return r->refs;
+}
+
+/* Returns the GLOBS_STATE_* flags of a bitsim state */
+static unsigned
+bitsim_flags(const struct globs *globs, unsigned state)
+{
+	const struct bitsim *b = globs->bitsim;
+	unsigned mask = state ? state & ~BITSIM_STATE : b->initial;
+
+	return (mask & b->live ? 0 : GLOBS_STATE_DEAD) |
+	       (mask & b->more ? GLOBS_STATE_MORE : 0);
+}
+
+/*
+ * Converts the simulated globs into lazy globs, so that more globs
+ * can be added to them. The bitsim is kept to translate states.
+ */
+static void
+bitsim_thaw(struct globs *globs)
+{
+	free(globs->bound);
+	free(globs->boundclass);
+	globs_lazy(globs);
+}
+
+/*
+ * Translates a state reached before #bitsim_thaw() into the lazy
+ * state for the same NFA nodes.
+ */
+static unsigned
+bitsim_to_lazy(const struct globs *globs, unsigned state)
+{
+	const struct bitsim *b = globs->bitsim;
+	bitset *set = bitset_alloca(globs->lazy->nbits);
+	unsigned mask = state & ~BITSIM_STATE;
+
+	for (; mask; mask &= mask - 1)
+		bitset_insert(set, b->node[__builtin_ctz(mask)]);
+	return lazy_intern(globs, set);
+}
+
+/*------------------------------------------------------------
+ * Cache files
+ *
+ * A cache file holds the tables of globs compiled into a DFA, so that
+ * they can be mapped in by a later process instead of being rebuilt.
+ * The refs are pointers, so the file stores the index of the first
+ * glob added with each final's ref instead. The file is keyed by a
+ * hash of the glob strings and is only loaded for the same globs.
+ *
+ * The layout is the cache_header, then these arrays:
+ *	unsigned trans[nstates * nclasses]
+ *	unsigned bound[nbounds]
+ *	unsigned boundclass[nbounds - 1]
+ *	unsigned finalend[nstates]	(end of each state's finals)
+ *	unsigned finalseq[nfinals]
+ *	unsigned bytes[nbyterows * 256]
+ *	struct suffix nodesuffix[nstates]
+ *	unsigned char stateflags[nstates]
+ */
+
+/* Identifies the cache file format, and the machine's type sizes */
+#define CACHE_MAGIC	"globs\0\1\0"
+
+struct cache_header {
+	char magic[8];		/* CACHE_MAGIC */
+	unsigned long long key;	/* hash of the glob strings */
+	unsigned sizes;		/* CACHE_SIZES */
+	unsigned nglobs;
+	unsigned nstates, nclasses, nbounds, nbyterows, nfinals;
+	unsigned lowclass[NLOWCLASS];
+};
+
+/* Checks the machine's byte order and type sizes */
+#define CACHE_SIZES	(0x01000000 | sizeof (struct suffix) << 16 | \
+			 sizeof (unsigned) << 8 | sizeof (unsigned long long))
+
+/* Folds the bytes of a glob string into a key, with 64-bit FNV-1a */
+static unsigned long long
+key_update(unsigned long long key, const str *globstr)
+{
+	unsigned len = str_len(globstr), i;
+	stri si;
+
+	for (i = 0; i < sizeof len; ++i) {
+		key ^= (len >> (8 * i)) & 0xff;
+		key *= 0x100000001b3ull;
+	}
+	for (si = stri_str(globstr); stri_more(si); stri_inc(si)) {
+		key ^= (unsigned char)stri_at(si);
+		key *= 0x100000001b3ull;
+	}
+	return key;
+}
+
+/*
+ * Returns the size of the arrays after a cache_header, computed in
+ * size_t so that no count can wrap it.
+ * @returns 0 if the counts are empty or their size overflows
+ */
+static size_t
+cache_size(const struct cache_header *h)
+{
+	size_t nwords, trans, bytes, size;
+
+	if (!h->nstates || !h->nbounds)
+		return 0;
+	if (__builtin_mul_overflow((size_t)h->nstates, h->nclasses, &trans) ||
+	    __builtin_mul_overflow((size_t)h->nbyterows, 256, &bytes) ||
+	    __builtin_add_overflow(trans, bytes, &nwords) ||
+	    __builtin_add_overflow(nwords, 2 * (size_t)h->nbounds - 1 +
+				   h->nstates + (size_t)h->nfinals, &nwords) ||
+	    __builtin_mul_overflow(nwords, sizeof (unsigned), &size) ||
+	    __builtin_add_overflow(size, (size_t)h->nstates *
+				   (sizeof (struct suffix) + 1), &size))
+		return 0;
+	return size;
+}
+
+/* Releases the tables of loaded globs, which are in the mapped file */
+static void
+cache_unmap(struct globs *globs)
+{
+	munmap(globs->map, globs->maplen);
+	globs->map = 0;
+	globs->trans = 0;
+	globs->bound = 0;
+	globs->boundclass = 0;
+	globs->bytes = 0;
+	globs->nodesuffix = 0;
+	globs->stateflags = 0;
+}
+
+int
+globs_save(const struct globs *globs, const char *path)
+{
+	const struct nfa *dfa = &globs->dfa;
+	struct cache_header h;
+	unsigned *finalend, *finalseq;
+	unsigned s, j, k;
+	char tmp[1024];
+	FILE *f;
+	int ok;
+
+	if (globs->lazy || globs->bitsim || !globs->trans || globs->map) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (snprintf(tmp, sizeof tmp, "%s.%ld", path, (long)getpid()) >=
+	    (int)sizeof tmp)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, CACHE_MAGIC, sizeof h.magic);
+	h.key = globs->key;
+	h.sizes = CACHE_SIZES;
+	h.nglobs = globs->nglobs;
+	h.nstates = globs->nstates;
+	h.nclasses = globs->nclasses;
+	h.nbounds = globs->nbounds;
+	h.nbyterows = globs->nbyterows;
+	memcpy(h.lowclass, globs->lowclass, sizeof h.lowclass);
+	for (s = 0; s < h.nstates; ++s)
+		h.nfinals += dfa->nodes[s].nfinals;
+
+	finalend = malloc(h.nstates * sizeof *finalend);
+	finalseq = malloc((h.nfinals + 1) * sizeof *finalseq);
+	for (s = k = 0; s < h.nstates; ++s) {
+		for (j = 0; j < dfa->nodes[s].nfinals; ++j)
+			finalseq[k++] = refseq_get(globs,
+						   dfa->nodes[s].finals[j]);
+		finalend[s] = k;
+	}
+
+	f = fopen(tmp, "wb");
+	if (!f) {
+		free(finalend);
+		free(finalseq);
+		return -1;
+	}
+	ok = fwrite(&h, sizeof h, 1, f) == 1 &&
+	     fwrite(globs->trans, sizeof (unsigned),
+		    h.nstates * h.nclasses, f) == h.nstates * h.nclasses &&
+	     fwrite(globs->bound, sizeof (unsigned), h.nbounds, f) ==
+		    h.nbounds &&
+	     fwrite(globs->boundclass, sizeof (unsigned), h.nbounds - 1, f) ==
+		    h.nbounds - 1 &&
+	     fwrite(finalend, sizeof (unsigned), h.nstates, f) == h.nstates &&
+	     fwrite(finalseq, sizeof (unsigned), h.nfinals, f) == h.nfinals &&
+	     (!h.nbyterows ||
+	      fwrite(globs->bytes, sizeof (unsigned), h.nbyterows * 256, f) ==
+		    h.nbyterows * 256) &&
+	     fwrite(globs->nodesuffix, sizeof (struct suffix), h.nstates, f) ==
+		    h.nstates &&
+	     fwrite(globs->stateflags, 1, h.nstates, f) == h.nstates;
+	ok = (fclose(f) == 0) && ok;
+	free(finalend);
+	free(finalseq);
+	if (!ok || rename(tmp, path) == -1) {
+		int e = errno;
+		unlink(tmp);
+		errno = e;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Checks that the tables of loaded globs only refer to states,
+ * classes and rows that exist, so that a corrupt cache file cannot
+ * lead the stepping functions out of bounds.
+ * @returns 0 if a table entry is out of range
+ */
+static int
+cache_check(const struct globs *globs)
+{
+	const unsigned nstates = globs->nstates;
+	const unsigned nclasses = globs->nclasses;
+	unsigned t;
+	size_t i;
+
+	if (!nclasses || globs->nbounds < 2 ||
+	    (globs->nbyterows && globs->nbyterows < nstates))
+		return 0;
+	for (i = 0; i < (size_t)nstates * nclasses; ++i)
+		if (globs->trans[i] >= nstates && globs->trans[i] != NOSTATE)
+			return 0;
+	for (i = 0; i < NLOWCLASS; ++i)
+		if (globs->lowclass[i] >= nclasses)
+			return 0;
+	for (i = 0; i + 1 < globs->nbounds; ++i)
+		if (globs->boundclass[i] >= nclasses ||
+		    globs->bound[i] >= globs->bound[i + 1])
+			return 0;
+	for (i = 0; i < (size_t)globs->nbyterows * 256; ++i) {
+		t = globs->bytes[i];
+		if (t >= nstates && t != NOSTATE && t != BYTE_FALLBACK &&
+		    (!(t & BYTE_MORE) || (t & ~BYTE_MORE) >= globs->nbyterows))
+			return 0;
+	}
+	for (i = 0; i < nstates; ++i)
+		if (globs->nodesuffix[i].len > GLOBS_SUFFIX_MAX &&
+		    globs->nodesuffix[i].len != SUFFIX_NONE)
+			return 0;
+	return 1;
+}
+
+struct globs *
+globs_load(const char *path, const str * const *globstrs,
+	   const void * const *refs, unsigned n)
+{
+	const struct cache_header *h;
+	const unsigned *a, *finalend, *finalseq;
+	unsigned long long key = KEY_INIT;
+	struct globs *globs;
+	const void **finals;
+	struct stat st;
+	void *map;
+	unsigned i, s;
+	int fd;
+
+	for (i = 0; i < n; ++i)
+		key = key_update(key, globstrs[i]);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof *h) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	h = map;
+	if (memcmp(h->magic, CACHE_MAGIC, sizeof h->magic) != 0 ||
+	    h->sizes != CACHE_SIZES || h->key != key || h->nglobs != n ||
+	    !cache_size(h) ||
+	    (size_t)st.st_size - sizeof *h != cache_size(h))
+	{
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	globs = globs_new();
+	globs->map = map;
+	globs->maplen = st.st_size;
+	globs->key = key;
+	globs->nglobs = n;
+	globs->nstates = h->nstates;
+	globs->nclasses = h->nclasses;
+	globs->nbounds = h->nbounds;
+	globs->nbyterows = h->nbyterows;
+	memcpy(globs->lowclass, h->lowclass, sizeof globs->lowclass);
+	a = (const unsigned *)(h + 1);
+	globs->trans = (unsigned *)a;
+	a += (size_t)h->nstates * h->nclasses;
+	globs->bound = (unsigned *)a;
+	a += h->nbounds;
+	globs->boundclass = (unsigned *)a;
+	a += h->nbounds - 1;
+	finalend = a;
+	a += h->nstates;
+	finalseq = a;
+	a += h->nfinals;
+	globs->bytes = h->nbyterows ? (unsigned *)a : NULL;
+	a += (size_t)h->nbyterows * 256;
+	globs->nodesuffix = (struct suffix *)a;
+	globs->stateflags = (unsigned char *)(globs->nodesuffix + h->nstates);
+	if (!cache_check(globs)) {
+		globs_free(globs);
+		return NULL;
+	}
+
+	/* Only the finals of the DFA's nodes are needed */
+	finals = malloc((h->nfinals + 1) * sizeof *finals);
+	for (i = 0; i < h->nfinals; ++i) {
+		if (finalseq[i] >= n) {
+			free(finals);
+			globs_free(globs);
+			return NULL;
+		}
+		finals[i] = refs[finalseq[i]];
+	}
+	globs->dfa.pool = finals;
+	globs->dfa.nnodes = h->nstates;
+	globs->dfa.nodes = calloc(h->nstates, sizeof *globs->dfa.nodes);
+	for (s = i = 0; s < h->nstates; i = finalend[s++]) {
+		if (finalend[s] < i || finalend[s] > h->nfinals) {
+			globs_free(globs);
+			return NULL;
+		}
+		globs->dfa.nodes[s].finals = &finals[i];
+		globs->dfa.nodes[s].nfinals = finalend[s] - i;
+	}
+	return globs;
+}
+
+void
+globs_set_cache_limit(struct globs *globs, unsigned bytes)
+{
+	globs->cache_limit = bytes;
+}
+
+void
+globs_flush_states(struct globs *globs)
+{
+	struct lazy *lazy = globs->lazy;
+	unsigned i;
+
+	if (!lazy)
+		return;
+	for (i = 0; i < lazy->nstates; ++i)
+		lazy_drop_row(lazy, i);
+	for (i = 1; i < lazy->nstates; ++i) {
+		bitset_free(lazy->set[i]);
+		free(lazy->refs[i]);
+	}
+	lazy->nstates = 1;
+
+	/* Shrink the per-state arrays back to their initial size */
+	lazy->capacity = 16;
+	lazy->set = realloc(lazy->set, lazy->capacity * sizeof *lazy->set);
+	lazy->nrefs = realloc(lazy->nrefs,
+		lazy->capacity * sizeof *lazy->nrefs);
+	lazy->refs = realloc(lazy->refs, lazy->capacity * sizeof *lazy->refs);
+	lazy->flags = realloc(lazy->flags,
+		lazy->capacity * sizeof *lazy->flags);
+	lazy->row = realloc(lazy->row, lazy->capacity * sizeof *lazy->row);
+	lazy->rowlen = realloc(lazy->rowlen,
+		lazy->capacity * sizeof *lazy->rowlen);
+	lazy->hashsz = 16;
+	lazy_rehash(lazy);
+}
+
+void
+globs_compile_flags(struct globs *globs, unsigned flags)
+{
+	if (globs->map)
+		return;		/* already compiled */
+
+	/* Discard any earlier compilation */
+	lazy_free(globs->lazy);
+	globs->lazy = 0;
+	bitsim_free(globs->bitsim);
+	globs->bitsim = 0;
+	free(globs->trans);
+	globs->trans = 0;
+	free(globs->stateflags);
+	globs->stateflags = 0;
+	free(globs->bound);
+	globs->bound = 0;
+	free(globs->boundclass);
+	globs->boundclass = 0;
+	free(globs->bytes);
+	globs->bytes = 0;
+	globs->nbyterows = 0;
+
+	if (flags & GLOBS_LAZY) {
+		globs_lazy(globs);
+		globs_set_suffixes(globs);
+		return;
+	}
+	if (!(flags & (GLOBS_BYTES | GLOBS_DFA)) && globs_bitsim(globs)) {
+		globs_set_suffixes(globs);
+		return;
+	}
+	if (globs->nliterals)
+		literals_detach(globs);
+	nfa_to_dfa(&globs->dfa);
+	if (globs->nliterals)
+		literals_insert(globs);
+	globs_tabulate(globs);
+	globs_state_flags_tabulate(globs);
+	globs_set_suffixes(globs);
+	if (flags & GLOBS_BYTES)
+		globs_lower_bytes(globs);
+}
+
+void
+globs_compile(struct globs *globs)
+{
+	globs_compile_flags(globs, 0);
+}
+
+int
+globs_step(const struct globs *globs, unsigned ch, unsigned *statep)
+{
+	unsigned next;
+
+	if (globs->lazy) {
+		if (globs->bitsim && *statep & BITSIM_STATE)
+			*statep = bitsim_to_lazy(globs, *statep);
+		return lazy_step(globs, globs_class(globs, ch), statep);
+	}
+	if (globs->bitsim)
+		return bitsim_step(globs, globs_class(globs, ch), statep);
+	next = globs->trans[*statep * globs->nclasses + globs_class(globs, ch)];
+	if (next == NOSTATE)
+		return 0;
+	*statep = next;
+	return 1;
+}
+
+int
+globs_step_utf8(const struct globs *globs, stri *i, unsigned *statep)
+{
+	const unsigned *row;
+	unsigned t;
+	stri start = *i;
+
+	if (!globs->bytes)
+		return globs_step(globs, stri_utf8_inc(i), statep);
+
+	row = &globs->bytes[*statep * 256];
+	for (;;) {
+		t = row[stri_at(*i) & 0xff];
+		stri_inc(*i);
+		if (t < globs->nstates) {
+			*statep = t;
+			return 1;
+		}
+		if (t == NOSTATE)
+			return 0;
+		if (t == BYTE_FALLBACK || !stri_more(*i))
+			break;
+		row = &globs->bytes[(t & ~BYTE_MORE) * 256];
+	}
+	/* Invalid or truncated UTF-8; decode it the slow way */
+	*i = start;
+	return globs_step(globs, stri_utf8_inc(i), statep);
+}
+
+const void *
+globs_is_accept_state(const struct globs *globs, unsigned state)
+{
+        const struct node *node;
+
+	if (globs->bitsim && (!globs->lazy || state & BITSIM_STATE))
+		return bitsim_accept(globs, state);
+	if (globs->lazy)
+		return globs->lazy->nrefs[state] ? globs->lazy->refs[state][0]
+						 : NULL;
+	node = &globs->dfa.nodes[state];
+	if (!node->nfinals)
+		return NULL;
+	return node->finals[0];
+}
+
+unsigned
+globs_state_flags(const struct globs *globs, unsigned state)
+{
+	if (globs->bitsim && (!globs->lazy || state & BITSIM_STATE))
+		return bitsim_flags(globs, state);
+	if (globs->lazy)
+		return globs->lazy->flags[state];
+	return globs->stateflags[state];
+}
+
+const void * const *
+globs_accept_refs(const struct globs *globs, unsigned state,
+		  unsigned *nrefs_return)
+{
+	const struct node *node;
+
+	if (globs->bitsim && (!globs->lazy || state & BITSIM_STATE))
+		return bitsim_refs(globs, state, nrefs_return);
+	if (globs->lazy) {
+		*nrefs_return = globs->lazy->nrefs[state];
+		return globs->lazy->refs[state];
+	}
+	node = &globs->dfa.nodes[state];
+	*nrefs_return = node->nfinals;
+	return node->finals;
+}
+
+unsigned
+globs_state_suffix(const struct globs *globs, unsigned state, char *buf)
+{
+	const struct suffix *ns = globs->nodesuffix;
+	struct suffix suf;
+	unsigned i;
+
+	suf.len = SUFFIX_NONE;
+	if (globs->bitsim && (!globs->lazy || state & BITSIM_STATE)) {
+		const struct bitsim *b = globs->bitsim;
+		unsigned mask = state ? state & ~BITSIM_STATE : b->initial;
+
+		for (; mask; mask &= mask - 1)
+			suffix_meet(&suf, &ns[b->node[__builtin_ctz(mask)]]);
+	} else if (globs->lazy) {
+		bitset_for(i, globs->lazy->set[state])
+			suffix_meet(&suf, &ns[i]);
+	} else
+		suf = ns[state];
+	if (suf.len == SUFFIX_NONE)
+		return 0;
+	memcpy(buf, suf.bytes + GLOBS_SUFFIX_MAX - suf.len, suf.len);
+	return suf.len;
+}
+
+int
+globs_is_shareable(const struct globs *globs)
+{
+	return !globs->lazy;
+}
+
+/* Number of strings that globs_match_many() steps in turn */
+#define MATCH_LANES 8
+
+void
+globs_match_many(const struct globs *globs, const str * const *strs,
+		 unsigned n, const void **refs_out)
+{
+	struct {
+		const str *s;		/* current segment */
+		const unsigned char *p;	/* next byte in the segment */
+		const unsigned char *end;
+		unsigned state;
+		unsigned k;		/* index into strs[] */
+	} lane[MATCH_LANES], *ln;
+	/* ASCII is stepped inline when the DFA is tabulated */
+	const unsigned *trans = globs->lazy || globs->bitsim ? NULL
+							    : globs->trans;
+	const unsigned nclasses = globs->nclasses;
+	unsigned nlanes = 0, next = 0, l;
+
+	for (;;) {
+		while (nlanes < MATCH_LANES && next < n) {
+			ln = &lane[nlanes];
+			ln->k = next++;
+			ln->s = strs[ln->k];
+			ln->p = ln->end = NULL;
+			ln->state = 0;
+			if (ln->s) {
+				ln->p = (const unsigned char *)ln->s->seg->data +
+					ln->s->offset;
+				ln->end = ln->p + ln->s->len;
+			}
+			nlanes++;
+		}
+		if (!nlanes)
+			break;
+
+		/* Step each lane by one character */
+		for (l = 0; l < nlanes; ) {
+			ln = &lane[l];
+			if (ln->p == ln->end) {
+				ln->s = ln->s ? ln->s->next : NULL;
+				if (!ln->s) {
+					refs_out[ln->k] = globs_is_accept_state(
+						globs, ln->state);
+					lane[l] = lane[--nlanes];
+					continue;
+				}
+				ln->p = (const unsigned char *)ln->s->seg->data +
+					ln->s->offset;
+				ln->end = ln->p + ln->s->len;
+			}
+			if (*ln->p < 0x80 && trans) {
+				unsigned t = trans[ln->state * nclasses +
+						   globs->lowclass[*ln->p]];
+				if (t == NOSTATE)
+					goto reject;
+				ln->state = t;
+				ln->p++;
+			} else {
+				stri i;
+
+				i.str = ln->s;
+				i.pos = ln->p - ((const unsigned char *)
+					ln->s->seg->data + ln->s->offset);
+				if (!globs_step_utf8(globs, &i, &ln->state))
+					goto reject;
+				/* Resume at the iterator, which may have
+				 * moved into a later segment */
+				ln->s = i.str;
+				if (!ln->s) {
+					ln->p = ln->end = NULL;
+				} else {
+					ln->end = (const unsigned char *)
+						ln->s->seg->data +
+						ln->s->offset + ln->s->len;
+					ln->p = ln->end - ln->s->len + i.pos;
+				}
+			}
+			l++;
+			continue;
+		reject:
+			refs_out[ln->k] = NULL;
+			lane[l] = lane[--nlanes];
+		}
+	}
 }
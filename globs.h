@@ -7,8 +7,8 @@
  * (automaton) capable of matching strings against all of the member
  * glob patterns within it.  The automaton states within the globs are
  * identified by an unsigned integer, and the interfaces below require
- * callers to provide their own state storage. Once constructed, globs
- * should be treated as immutable.
+ * callers to provide their own state storage. Globs may be added
+ * after compilation; this does not invalidate existing states.
  *
  * Glob Pattern Syntax
  *
@@ -28,12 +28,18 @@
  *      ?(pattern|...)          - 0 or 1 of the patterns
  *      *(pattern|...)          - 0 or more "
  *      +(pattern|...)          - 1 or more "
- *      !(pattern|...)          - (NOT SUPPORTED!)
+ *      !(pattern|...)          - any string free of / that matches
+ *                                none of the patterns
  *      otherwise               - a literal character
+ *
+ * So !(...) matches within one path component, as * does. Unlike
+ * glibc's fnmatch() with FNM_EXTMATCH, it never matches across a '/',
+ * even where the patterns would not match the longer string.
  */
 struct globs;
 
 struct str; /* forward decl */
+struct str_iter;
 
 /** Creates a new, empty glob set.  */
 struct globs *globs_new(void);
@@ -46,6 +52,14 @@ void globs_free(struct globs *globs);
  * a reference value that will be accessible when a string matches
  * the expression.
  *
+ * When the globs have already been compiled, the new glob is united
+ * into the automaton at a cost proportional to the glob, rather than
+ * by recompiling. (Compiled globs first convert to #GLOBS_LAZY, whose
+ * states are computed on demand.) Existing states remain valid, but
+ * only a state reached afterwards from the initial state 0 can match
+ * the new glob. Calling #globs_compile() again merges everything back
+ * into a single DFA, but invalidates existing states.
+ *
  * @param globs       The set of patterns to add to
  * @param globstr     A UTF-8 string containing an extended
  *                    glob expression. (NOT TAKEN) (See above)
@@ -59,10 +73,62 @@ const char *globs_add(struct globs *globs,
 
 /**
  * Compile the globs into an efficient state.
- * After this, no more globs can be added.
+ * This is the same as #globs_compile_flags() with no flags.
  */
 void globs_compile(struct globs *globs);
 
+/**
+ * Compile the globs, with optional extra representations.
+ *
+ * @param globs  the set of globs
+ * @param flags  zero, or a bitwise-OR of:
+ *               #GLOBS_BYTES - also lower the automaton into a
+ *               UTF-8 byte automaton, so that #globs_step_utf8()
+ *               need not decode characters.
+ *               #GLOBS_LAZY - don't construct the DFA now; instead
+ *               construct its states as #globs_step() reaches them,
+ *               keeping their transitions in a bounded cache
+ *               (see #globs_set_cache_limit()). #GLOBS_BYTES is
+ *               ignored.
+ *               #GLOBS_DFA - always construct the DFA. Otherwise,
+ *               globs with few enough NFA positions (at most 31) are
+ *               simulated bit-parallel instead, which saves the cost
+ *               of subset construction when they are matched only a
+ *               few times. #GLOBS_BYTES implies #GLOBS_DFA.
+ */
+void globs_compile_flags(struct globs *globs, unsigned flags);
+#define GLOBS_BYTES	0x1
+#define GLOBS_LAZY	0x2
+#define GLOBS_DFA	0x4
+
+/**
+ * Sets the memory limit for the transitions cached by a #GLOBS_LAZY
+ * globs. When the cache would exceed this limit, it is flushed, and
+ * transitions are recomputed from the NFA as they are needed again.
+ *
+ * The limit does not cover the states themselves: the NFA node set,
+ * accepted refs and flags of every state reached so far are retained,
+ * so that existing state values stay valid. Their memory grows with
+ * the number of distinct states reached, which for some globs is
+ * exponential in the length of the input; see #globs_flush_states().
+ *
+ * @param globs  the set of globs
+ * @param bytes  the cache limit in bytes; the default is 1 MiB.
+ */
+void globs_set_cache_limit(struct globs *globs, unsigned bytes);
+
+/**
+ * Discards every state of a #GLOBS_LAZY globs except the initial
+ * state 0, releasing the memory of the states reached so far.
+ * All other state values become invalid; matching must restart
+ * from state 0. Callers that step long or untrusted inputs can
+ * call this between matches to bound the memory used.
+ * Has no effect on globs not compiled with #GLOBS_LAZY.
+ *
+ * @param globs  the compiled set of globs
+ */
+void globs_flush_states(struct globs *globs);
+
 /**
  * Tries to advance a globs match state.
  *
@@ -75,6 +141,26 @@ void globs_compile(struct globs *globs);
  */
 int globs_step(const struct globs *globs, unsigned ch, unsigned *statep);
 
+/**
+ * Tries to advance a globs match state over the next UTF-8 encoded
+ * character of a string.
+ * This has the same effect as
+ *    globs_step(globs, stri_utf8_inc(i), statep)
+ * including for invalid UTF-8 (see #IS_INVALID_UTF8), but when the
+ * globs were compiled with #GLOBS_BYTES, the raw bytes are
+ * stepped without decoding them.
+ *
+ * @param globs  the set of globs
+ * @param i      the string iterator to advance; there must
+ *               be more characters to read.
+ * @param statep pointer to the state to advance
+ *
+ * @returns non-zero if the state advanced, or
+ *          0 if the character was rejected.
+ */
+int globs_step_utf8(const struct globs *globs, struct str_iter *i,
+		    unsigned *statep);
+
 /**
  * Tests if the given state is an accept state.
  *
@@ -86,4 +172,131 @@ int globs_step(const struct globs *globs, unsigned ch, unsigned *statep);
  */
 const void *globs_is_accept_state(const struct globs *globs, unsigned state);
 
+/**
+ * Finds the refs of all the globs that an accept state matches,
+ * in the order that the globs were added.
+ * The first is the ref returned by #globs_is_accept_state().
+ *
+ * @param globs         the set of globs
+ * @param state         the state being tested
+ * @param nrefs_return  where to store the number of refs, which is
+ *                      0 if the state is not an accept state
+ *
+ * The refs of a state of a small NFA (see #globs_is_shareable())
+ * are merged when the state is first queried, so this may modify the
+ * globs.
+ *
+ * @returns the array of refs, owned by the globs. It remains valid
+ *          until the globs are changed by #globs_add() or recompiled.
+ */
+const void * const *globs_accept_refs(const struct globs *globs,
+				      unsigned state, unsigned *nrefs_return);
+
+/**
+ * Describes what can still happen from a state, so that a matcher
+ * can stop early.
+ *
+ * @param globs  the set of globs
+ * @param state  the state being tested
+ *
+ * @returns a bitwise-OR of:
+ *          #GLOBS_STATE_DEAD - no string, not even the empty
+ *          string, leads from the state to an accept state.
+ *          #GLOBS_STATE_MORE - some non-empty string leads from the
+ *          state to an accept state.
+ *          #GLOBS_STATE_ALL - the state accepts, and every string
+ *          free of NUL and '/' leads to an accept state with the
+ *          same ref. (As ? and * never match '/', this is as strong
+ *          as a glob can be.) This flag is only computed for globs
+ *          compiled into a DFA; otherwise it is never set.
+ */
+unsigned globs_state_flags(const struct globs *globs, unsigned state);
+#define GLOBS_STATE_DEAD	0x1
+#define GLOBS_STATE_MORE	0x2
+#define GLOBS_STATE_ALL		0x4
+
+/**
+ * Matches many strings against the globs.
+ * Several strings are stepped in turn, so that their table lookups
+ * overlap, and ASCII bytes of a tabulated DFA are stepped without
+ * calling #globs_step().
+ *
+ * @param globs     the compiled set of globs
+ * @param strs      the strings to match; a NULL entry is the empty string
+ * @param n         the number of strings
+ * @param refs_out  where to store, for each string, the ref that
+ *                  #globs_is_accept_state() gives for the whole string,
+ *                  or NULL if the string is not accepted
+ */
+void globs_match_many(const struct globs *globs,
+		      const struct str * const *strs, unsigned n,
+		      const void **refs_out);
+
+/**
+ * Tests if the globs may be stepped from several threads at once.
+ * Globs whose states are computed on demand (see #GLOBS_LAZY) are
+ * modified as they are stepped, and so are not shareable.
+ *
+ * Even shareable globs are modified by #globs_accept_refs() when they
+ * are simulated as a small NFA, which merges the refs of a state that
+ * accepts several globs on demand. So #globs_accept_refs() must not be
+ * called concurrently with any other function on the same globs.
+ *
+ * @param globs  the compiled set of globs
+ *
+ * @returns non-zero if the stepping and state query functions, other
+ *          than #globs_accept_refs(), may be called concurrently
+ */
+int globs_is_shareable(const struct globs *globs);
+
+/**
+ * Finds literal text that every string accepted from a state must
+ * end with, taken from the ends of the globs still reachable.
+ * A matcher can use it to reject candidate strings without stepping
+ * through them.
+ *
+ * @param globs  the set of globs
+ * @param state  the state being tested
+ * @param buf    where to store the suffix bytes (not NUL-terminated),
+ *               which has room for #GLOBS_SUFFIX_MAX bytes
+ *
+ * @returns the length of the suffix, which may be 0
+ */
+unsigned globs_state_suffix(const struct globs *globs, unsigned state,
+			    char *buf);
+#define GLOBS_SUFFIX_MAX	15
+
+/**
+ * Saves compiled globs to a cache file, so that a later process can
+ * load them with #globs_load() instead of compiling them again.
+ * The file is written under a temporary name, then renamed.
+ *
+ * @param globs  the globs, compiled into a DFA (see #GLOBS_DFA)
+ * @param path   the cache file to replace
+ *
+ * @returns 0 on success, or -1 on error with errno set.
+ *          The error is EINVAL if the globs were not compiled into
+ *          a DFA, or were themselves loaded from a cache file.
+ */
+int globs_save(const struct globs *globs, const char *path);
+
+/**
+ * Loads globs from a cache file written by #globs_save(), if they
+ * were compiled from the same glob strings. The file is mapped
+ * read-only; nothing is parsed or constructed but the accept states'
+ * refs. The loaded globs are already compiled, and no more globs can
+ * be added to them.
+ *
+ * @param path      the cache file
+ * @param globstrs  the glob strings, in the order they were added
+ * @param refs      the ref to give each glob
+ * @param n         the number of globs
+ *
+ * @returns the loaded globs, to be released with #globs_free(),
+ *          or NULL if the file is missing, invalid or for other globs.
+ */
+struct globs *globs_load(const char *path,
+			 const struct str * const *globstrs,
+			 const void * const *refs, unsigned n);
+
 #endif /* globs_h */
@@ -89,6 +89,7 @@ main(int argc, char *argv[])
 	struct rule *rule, *rules, **rp = &rules;
 	int files_loaded = 0;
 	struct globs *globs = 0;
+	const char *cache = 0;
 	int reached;
 
 	/* Create and populate the initial scope */
@@ -96,7 +97,7 @@ main(int argc, char *argv[])
 	add_environ_vars(scope);
 
 	/* Collect option switches */
-	while ((ch = getopt(argc, argv, "vf:")) != -1) {
+	while ((ch = getopt(argc, argv, "vf:c:")) != -1) {
 	    switch (ch) {
 	    case 'v':
 	    	if (verbosity < V_DEBUG)
@@ -106,6 +107,9 @@ main(int argc, char *argv[])
 	    	rp = load_rules_file(rp, optarg, scope, &error);
 		files_loaded++;
 		break;
+	    case 'c':
+		cache = optarg;
+		break;
 	    default: error = 1;
 	    }
 	}
@@ -114,6 +118,7 @@ main(int argc, char *argv[])
 		fprintf(stderr, "usage: %s"
 				" [-v]"
 				" [-f rulefile]"
+				" [-c cachefile]"
 				" [goal ...]"
 				"\n",
 			argv[0]
@@ -155,20 +160,46 @@ main(int argc, char *argv[])
 		error = 1;
 	}
 
-	/* Build a globset to match all the rule goals */
-	globs = globs_new();
+	/* Build a globset to match all the rule goals, unless the
+	 * cache holds one compiled from the same goals */
+	unsigned ngoals = 0, i;
 	for (rule = rules; rule; rule = rule->next) {
-		const char *errmsg;
 		if (!rule->goal.str) {
 		    x = &rule->goal.str;
 		    x = expand_macro(x, rule->goal.macro, scope);
 		    *x = 0;
 		}
-		errmsg = globs_add(globs, rule->goal.str, rule);
-		if (errmsg) {
-			prl_error(&rule->location, "%s", errmsg);
-			error = 1;
+		ngoals++;
+	}
+	if (cache) {
+		const str **goals = malloc(ngoals * sizeof *goals);
+		const void **refs = malloc(ngoals * sizeof *refs);
+		for (i = 0, rule = rules; rule; rule = rule->next, i++) {
+			goals[i] = rule->goal.str;
+			refs[i] = rule;
 		}
+		globs = globs_load(cache, goals, refs, ngoals);
+		free(goals);
+		free(refs);
+		if (globs)
+			pr_debug("loaded goals from %s", cache);
+	}
+	if (!globs) {
+		int goal_error = 0;
+		globs = globs_new();
+		for (rule = rules; rule; rule = rule->next) {
+			const char *errmsg;
+			errmsg = globs_add(globs, rule->goal.str, rule);
+			if (errmsg) {
+				prl_error(&rule->location, "%s", errmsg);
+				goal_error = 1;
+			}
+		}
+		globs_compile_flags(globs, cache ? GLOBS_DFA : 0);
+		if (cache && !goal_error && globs_save(globs, cache) == -1)
+			pr_warning("%s: %s", cache, strerror(errno));
+		if (goal_error)
+			error = 1;
 	}
 
 	reached = state(globs, args_prereq, scope);
@@ -0,0 +1,568 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "match.h"
+#include "globs.h"
+#include "str.h"
+
+/* Benchmark for matching globs against a large directory tree */
+
+/* Shape of the synthetic tree */
+#define FANOUT	8	/* subdirectories per directory */
+#define NFILES	64	/* files per directory */
+#define DEPTH	4	/* levels of subdirectories */
+
+/* File name templates; %u is replaced with the file number */
+static const char * const file_names[] = {
+	"file%u.txt", "eth%u@UP", "net%u@active", "lib%u.so.1",
+};
+#define NFILE_NAMES (sizeof file_names / sizeof file_names[0])
+
+/* The glob patterns to match against the tree */
+static const char * const patterns[] = {
+	"*/*/*.txt",
+	"d1/*/*/file1*",
+	"*/*@UP",
+	"d[0-3]/d?/*/*/net+([0-9])@active",
+	"*/*/*/*/lib*.so.?",
+};
+#define NPATTERNS (sizeof patterns / sizeof patterns[0])
+
+/* Patterns that only reach the top of the tree */
+static const char * const shallow_patterns[] = {
+	"*.txt",
+	"d[0-3]/eth*",
+	"d?/d?/",
+};
+#define NSHALLOW (sizeof shallow_patterns / sizeof shallow_patterns[0])
+
+/* Patterns that all end with the same literal */
+static const char * const suffix_patterns[] = {
+	"*/*@UP",
+	"*/*/*/*@UP",
+	"d[0-3]/*/*/*/eth*@UP",
+};
+#define NSUFFIX (sizeof suffix_patterns / sizeof suffix_patterns[0])
+
+/*
+ * Generates the synthetic tree. The depth of a directory is the
+ * number of / in its prefix. A non-NULL context points to a delay in
+ * microseconds, to simulate reading a directory from a slow disk.
+ */
+static struct match **
+bench_generate(struct match **mp, const str *prefix, void *gcontext)
+{
+	unsigned depth = 0, i;
+	stri si;
+	char name[64];
+
+	for (si = stri_str(prefix); stri_more(si); stri_inc(si))
+		if (stri_at(si) == '/')
+			depth++;
+	if (gcontext)
+		usleep(*(const unsigned *)gcontext);
+
+	for (i = 0; i < NFILES; ++i) {
+		snprintf(name, sizeof name, file_names[i % NFILE_NAMES], i);
+		*mp = match_new(str_new(name));
+		mp = &(*mp)->next;
+	}
+	if (depth < DEPTH) {
+		for (i = 0; i < FANOUT; ++i) {
+			snprintf(name, sizeof name, "d%u/", i);
+			*mp = match_new(str_new(name));
+			(*mp)->flags |= MATCH_DEFERRED;
+			mp = &(*mp)->next;
+		}
+	}
+	return mp;
+}
+
+static const struct generator bench_generator = {
+	.generate = bench_generate,
+};
+
+/* Returns the current time in seconds */
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Compiles the patterns, then times the matcher over the synthetic tree.
+ *
+ * @param flags     the flags to pass to #globs_compile_flags()
+ * @param name      the name of the compile mode, to print
+ * @param patterns  the glob patterns to match
+ * @param npatterns the number of patterns
+ */
+static void
+bench_matcher(unsigned flags, const char *name,
+	      const char * const *patterns, unsigned npatterns)
+{
+	struct globs *globs = globs_new();
+	struct matcher *matcher;
+	unsigned i, nresults = 0;
+	double t0, t1;
+	str *result;
+
+	for (i = 0; i < npatterns; ++i) {
+		str *s = str_new(patterns[i]);
+		const char *err = globs_add(globs, s, patterns[i]);
+		str_free(s);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", patterns[i], err);
+			exit(1);
+		}
+	}
+	t0 = now();
+	globs_compile_flags(globs, flags);
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms\n", name, "globs_compile",
+		(t1 - t0) * 1e3);
+
+	t0 = now();
+	matcher = matcher_new(globs, &bench_generator, 0);
+	while ((result = matcher_next(matcher, 0))) {
+		nresults++;
+		str_free(result);
+	}
+	matcher_free(matcher);
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms (%u matches)\n", name, "matcher_next",
+		(t1 - t0) * 1e3, nresults);
+
+	globs_free(globs);
+}
+
+/* Number of single-glob compilations to time */
+#define NSINGLE	10000
+
+/**
+ * Times compiling a single glob and matching it once, as is done
+ * when matching a directive's glob against one goal.
+ *
+ * @param flags  the flags to pass to #globs_compile_flags()
+ * @param name   the name of the compile mode, to print
+ */
+static void
+bench_single(unsigned flags, const char *name)
+{
+	str *s = str_new("*.TIMEOUT");
+	str *goal = str_new("build.TIMEOUT");
+	unsigned i, naccept = 0;
+	double t0, t1;
+
+	t0 = now();
+	for (i = 0; i < NSINGLE; ++i) {
+		struct globs *globs = globs_new();
+		unsigned state = 0;
+		stri si;
+
+		globs_add(globs, s, s);
+		globs_compile_flags(globs, flags);
+		for (si = stri_str(goal); stri_more(si); )
+			if (!globs_step_utf8(globs, &si, &state))
+				break;
+		if (!stri_more(si) && globs_is_accept_state(globs, state))
+			naccept++;
+		globs_free(globs);
+	}
+	t1 = now();
+	printf("%-8s %-16s %10.3f us (%u matches)\n", name, "compile+match",
+		(t1 - t0) * 1e6 / NSINGLE, naccept);
+	str_free(goal);
+	str_free(s);
+}
+
+/* Number of literal goals to compile */
+#define NLITERALS	2000
+
+/**
+ * Times compiling many literal goals, along with a few patterns.
+ *
+ * @param flags  the flags to pass to #globs_compile_flags()
+ * @param name   the name of the compile mode, to print
+ */
+static void
+bench_literals(unsigned flags, const char *name)
+{
+	struct globs *globs = globs_new();
+	unsigned i, state, naccept = 0;
+	double t0, t1;
+	char buf[64];
+
+	t0 = now();
+	for (i = 0; i < NLITERALS; ++i) {
+		str *s;
+		snprintf(buf, sizeof buf, file_names[i % NFILE_NAMES], i);
+		s = str_new(buf);
+		globs_add(globs, s, s);
+		str_free(s);
+	}
+	for (i = 0; i < NPATTERNS; ++i) {
+		str *s = str_new(patterns[i]);
+		globs_add(globs, s, patterns[i]);
+		str_free(s);
+	}
+	globs_compile_flags(globs, flags);
+	t1 = now();
+	for (i = 0; i < NLITERALS; ++i) {
+		const char *c;
+		snprintf(buf, sizeof buf, file_names[i % NFILE_NAMES], i);
+		state = 0;
+		for (c = buf; *c; ++c)
+			if (!globs_step(globs, *c, &state))
+				break;
+		if (!*c && globs_is_accept_state(globs, state))
+			naccept++;
+	}
+	printf("%-8s %-16s %10.3f ms (%u matches)\n", name, "literals",
+		(t1 - t0) * 1e3, naccept);
+	globs_free(globs);
+}
+
+/* Number of pattern goals to compile */
+#define NPATTERN_GOALS	1024
+
+/**
+ * Times compiling a large set of goals that each hold a pattern,
+ * such as the rules of many network interfaces.
+ *
+ * @param flags  the flags to pass to #globs_compile_flags()
+ * @param name   the name of the compile mode, to print
+ */
+static void
+bench_pattern_goals(unsigned flags, const char *name)
+{
+	struct globs *globs = globs_new();
+	unsigned i, state, naccept = 0;
+	double t0, t1;
+	char buf[64];
+
+	t0 = now();
+	for (i = 0; i < NPATTERN_GOALS; ++i) {
+		str *s;
+		snprintf(buf, sizeof buf, "net%u/*@up", i);
+		s = str_new(buf);
+		globs_add(globs, s, s);
+		str_free(s);
+	}
+	globs_compile_flags(globs, flags);
+	t1 = now();
+	for (i = 0; i < NPATTERN_GOALS; ++i) {
+		const char *c;
+		snprintf(buf, sizeof buf, "net%u/eth%u@up", i, i);
+		state = 0;
+		for (c = buf; *c; ++c)
+			if (!globs_step(globs, *c, &state))
+				break;
+		if (!*c && globs_is_accept_state(globs, state))
+			naccept++;
+	}
+	printf("%-8s %-16s %10.3f ms (%u matches)\n", name, "pattern goals",
+		(t1 - t0) * 1e3, naccept);
+	globs_free(globs);
+}
+
+/**
+ * Times compiling the literal goals and patterns into a DFA,
+ * and loading the same DFA from a cache file.
+ */
+static void
+bench_cache()
+{
+	const unsigned n = NLITERALS + NPATTERNS;
+	str **strs = malloc(n * sizeof *strs);
+	const void **refs = malloc(n * sizeof *refs);
+	char path[] = "/tmp/match-b.XXXXXX";
+	struct globs *globs;
+	unsigned i;
+	double t0, t1;
+	char buf[64];
+	int fd;
+
+	for (i = 0; i < NLITERALS; ++i) {
+		snprintf(buf, sizeof buf, file_names[i % NFILE_NAMES], i);
+		strs[i] = str_new(buf);
+		refs[i] = strs[i];
+	}
+	for (i = 0; i < NPATTERNS; ++i) {
+		strs[NLITERALS + i] = str_new(patterns[i]);
+		refs[NLITERALS + i] = patterns[i];
+	}
+	fd = mkstemp(path);
+	if (fd == -1) {
+		perror(path);
+		exit(1);
+	}
+	close(fd);
+
+	t0 = now();
+	globs = globs_new();
+	for (i = 0; i < n; ++i)
+		globs_add(globs, strs[i], refs[i]);
+	globs_compile_flags(globs, GLOBS_DFA);
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms\n", "cache", "globs_compile",
+		(t1 - t0) * 1e3);
+	if (globs_save(globs, path) == -1) {
+		perror(path);
+		exit(1);
+	}
+	globs_free(globs);
+
+	t0 = now();
+	globs = globs_load(path, (const str * const *)strs, refs, n);
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms\n", "cache", "globs_load",
+		(t1 - t0) * 1e3);
+	if (!globs) {
+		fprintf(stderr, "%s: not loaded\n", path);
+		exit(1);
+	}
+	globs_free(globs);
+	unlink(path);
+
+	for (i = 0; i < n; ++i)
+		str_free(strs[i]);
+	free(strs);
+	free(refs);
+}
+
+/**
+ * Times the matcher over the synthetic tree with each traversal
+ * policy, and reports the peak length of its queue.
+ */
+static void
+bench_order()
+{
+	static const struct {
+		const char *name;
+		unsigned order, limit;
+	} policy[] = {
+		{ "lifo", MATCHER_LIFO, 0 },
+		{ "fifo", MATCHER_FIFO, 0 },
+		{ "fifo<1k", MATCHER_FIFO, 1000 },
+	};
+	struct globs *globs = globs_new();
+	unsigned i, p;
+
+	for (i = 0; i < NPATTERNS; ++i) {
+		str *s = str_new(patterns[i]);
+		globs_add(globs, s, patterns[i]);
+		str_free(s);
+	}
+	globs_compile(globs);
+
+	for (p = 0; p < sizeof policy / sizeof *policy; ++p) {
+		struct matcher *matcher;
+		unsigned nresults = 0;
+		double t0, t1;
+		str *result;
+
+		t0 = now();
+		matcher = matcher_new(globs, &bench_generator, 0);
+		matcher_set_order(matcher, policy[p].order);
+		matcher_set_limit(matcher, policy[p].limit);
+		while ((result = matcher_next(matcher, 0))) {
+			nresults++;
+			str_free(result);
+		}
+		t1 = now();
+		printf("%-8s %-16s %10.3f ms (%u matches, peak %u)\n",
+			policy[p].name, "matcher_next", (t1 - t0) * 1e3,
+			nresults, matcher_peak(matcher));
+		matcher_free(matcher);
+	}
+	globs_free(globs);
+}
+
+/* Counts the strings found by matcher_run() */
+static int
+count_found(const str *s, const void *ref, void *context)
+{
+	++*(unsigned *)context;
+	return 0;
+}
+
+/**
+ * Times the matcher over the synthetic tree, taking the results
+ * with #matcher_next() and with #matcher_run().
+ */
+static void
+bench_run()
+{
+	struct globs *globs = globs_new();
+	struct matcher *matcher;
+	unsigned i, nresults;
+	double t0, t1;
+	str *result;
+
+	for (i = 0; i < NPATTERNS; ++i) {
+		str *s = str_new(patterns[i]);
+		globs_add(globs, s, patterns[i]);
+		str_free(s);
+	}
+	globs_compile(globs);
+
+	nresults = 0;
+	t0 = now();
+	matcher = matcher_new(globs, &bench_generator, 0);
+	while ((result = matcher_next(matcher, 0))) {
+		nresults++;
+		str_free(result);
+	}
+	matcher_free(matcher);
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms (%u matches)\n", "run",
+		"matcher_next", (t1 - t0) * 1e3, nresults);
+
+	nresults = 0;
+	t0 = now();
+	matcher = matcher_new(globs, &bench_generator, 0);
+	matcher_run(matcher, count_found, &nresults);
+	matcher_free(matcher);
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms (%u matches)\n", "run",
+		"matcher_run", (t1 - t0) * 1e3, nresults);
+
+	globs_free(globs);
+}
+
+/* Simulated time to read a directory, in microseconds */
+#define READDIR_DELAY	20
+
+/**
+ * Times the matcher with worker threads over the synthetic tree,
+ * when reading each directory takes a while.
+ */
+static void
+bench_threads()
+{
+	static const unsigned nthreads[] = { 0, 2, 4, 8 };
+	static const unsigned delay = READDIR_DELAY;
+	struct globs *globs = globs_new();
+	unsigned i, t;
+	char name[16];
+
+	for (i = 0; i < NPATTERNS; ++i) {
+		str *s = str_new(patterns[i]);
+		globs_add(globs, s, patterns[i]);
+		str_free(s);
+	}
+	globs_compile(globs);
+
+	for (t = 0; t < sizeof nthreads / sizeof *nthreads; ++t) {
+		struct matcher *matcher;
+		unsigned nresults = 0;
+		double t0, t1;
+		str *result;
+
+		t0 = now();
+		matcher = matcher_new(globs, &bench_generator,
+				      (void *)&delay);
+		matcher_set_threads(matcher, nthreads[t]);
+		while ((result = matcher_next(matcher, 0))) {
+			nresults++;
+			str_free(result);
+		}
+		matcher_free(matcher);
+		t1 = now();
+		snprintf(name, sizeof name, "%ut", nthreads[t]);
+		printf("%-8s %-16s %10.3f ms (%u matches)\n",
+			name, "matcher_next", (t1 - t0) * 1e3, nresults);
+	}
+	globs_free(globs);
+}
+
+/* Number of strings to match in bulk */
+#define NMANY	100000
+
+/**
+ * Times matching many path strings, one at a time with
+ * #globs_step_utf8(), and in bulk with #globs_match_many().
+ */
+static void
+bench_many()
+{
+	struct globs *globs = globs_new();
+	str **strs = malloc(NMANY * sizeof *strs);
+	const void **refs = malloc(NMANY * sizeof *refs);
+	unsigned i, naccept;
+	double t0, t1;
+	char buf[64], name[32];
+
+	for (i = 0; i < NPATTERNS; ++i) {
+		str *s = str_new(patterns[i]);
+		globs_add(globs, s, patterns[i]);
+		str_free(s);
+	}
+	globs_compile(globs);
+	for (i = 0; i < NMANY; ++i) {
+		snprintf(name, sizeof name, file_names[i % NFILE_NAMES], i);
+		snprintf(buf, sizeof buf, "d%u/d%u/%s", i % 5, i % 7, name);
+		strs[i] = str_new(buf);
+	}
+
+	t0 = now();
+	naccept = 0;
+	for (i = 0; i < NMANY; ++i) {
+		unsigned state = 0;
+		int ok = 1;
+		stri si;
+
+		for (si = stri_str(strs[i]); ok && stri_more(si); )
+			ok = globs_step_utf8(globs, &si, &state);
+		if (ok && globs_is_accept_state(globs, state))
+			naccept++;
+	}
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms (%u matches)\n", "many", "globs_step",
+		(t1 - t0) * 1e3, naccept);
+
+	t0 = now();
+	globs_match_many(globs, (const str * const *)strs, NMANY, refs);
+	naccept = 0;
+	for (i = 0; i < NMANY; ++i)
+		if (refs[i])
+			naccept++;
+	t1 = now();
+	printf("%-8s %-16s %10.3f ms (%u matches)\n", "many",
+		"globs_match_many", (t1 - t0) * 1e3, naccept);
+
+	for (i = 0; i < NMANY; ++i)
+		str_free(strs[i]);
+	free(strs);
+	free(refs);
+	globs_free(globs);
+}
+
+int
+main()
+{
+	bench_literals(GLOBS_DFA, "dfa");
+	bench_literals(GLOBS_LAZY, "lazy");
+	bench_pattern_goals(0, "default");
+	bench_pattern_goals(GLOBS_LAZY, "lazy");
+	bench_single(0, "single");
+	bench_single(GLOBS_DFA, "dfa");
+	bench_matcher(0, "chars", patterns, NPATTERNS);
+	bench_matcher(GLOBS_BYTES, "bytes", patterns, NPATTERNS);
+	bench_matcher(GLOBS_LAZY, "lazy", patterns, NPATTERNS);
+	bench_matcher(0, "shallow", shallow_patterns, NSHALLOW);
+	bench_matcher(0, "suffix", suffix_patterns, NSUFFIX);
+	bench_order();
+	bench_run();
+	bench_threads();
+	bench_many();
+	bench_cache();
+	return 0;
+}
@@ -197,12 +197,18 @@ struct test_context {
 	struct tree *tree;
 };
 
+/* Number of calls to test_generate() */
+static unsigned Ngenerate;
+static unsigned Order = MATCHER_LIFO;	/* order used by assert_matches */
+static unsigned Threads;		/* threads used by assert_matches */
+
 struct match **
 test_generate(struct match **mp, const str *prefix, void *gcontext)
 {
 	struct test_context *ctxt = gcontext;
 	stri i;
 
+	__atomic_add_fetch(&Ngenerate, 1, __ATOMIC_RELAXED);
 	if (Debug) {
 		fprintf(stderr, "  ");
 		for (i = stri_str(prefix); stri_more(i); stri_inc(i))
@@ -241,8 +247,7 @@ test_generate(struct match **mp, const str *prefix, void *gcontext)
 	}
 	for (; node; node = node->sibling) {
 		str *mstr, **x;
-		x = str_xcatsn(str_xcat(&mstr, prefix),
-				node->path, node->pathlen);
+		x = str_xcatsn(&mstr, node->path, node->pathlen);
 		if (node->child) {
 			x = str_xcats(x, "/");
 		}
@@ -337,6 +342,8 @@ assert_matches_(const char *file, int lineno,
 		fprintf(stderr, "%s:%d: matching...\n", file, lineno);
 
 	struct matcher *matcher = matcher_new(globs, &test_generator, &tctxt);
+	matcher_set_order(matcher, Order);
+	matcher_set_threads(matcher, Threads);
 	unsigned matchremain = nexpected;
 
 	int error = 0;
@@ -408,6 +415,26 @@ assert_matches_(const char *file, int lineno,
 	matcher_free(matcher);
 }
 
+/* Collects the strings found by matcher_run() */
+struct found_context {
+	char buf[256];		/* "string=ref" separated by spaces */
+	unsigned nfound;
+	unsigned stop_at;	/* count at which to stop, or 0 */
+};
+
+static int
+found(const str *s, const void *ref, void *context)
+{
+	struct found_context *fc = context;
+	char *b = fc->buf + strlen(fc->buf);
+
+	b += str_copy(s, b, 0, str_len(s));
+	sprintf(b, "=%s ", (const char *)ref);
+	if (++fc->nfound == fc->stop_at)
+		return 7;
+	return 0;
+}
+
 /** Tests an environment variable e is set to indicate true */
 static int
 testenv(const char *e)
@@ -432,6 +459,176 @@ main()
 		TREE t = make_tree("a/", "a/b", "a/c", "b");
 		assert_matches(g, t, "a/b", "a/c");
 	}
+	{
+		/* Directories that no glob can look into are not
+		 * generated */
+		GLOBS g = make_globs("a/", "*/b*");
+		TREE t = make_tree("a/", "a/b/", "a/b/c", "a/bc",
+				   "x/", "x/y/", "x/y/z", "x/b");
+		Ngenerate = 0;
+		assert_matches(g, t, "a/bc", "x/b");
+		assert(Ngenerate == 3);	/* "", "a/", "x/" */
+	}
+	{
+		/* Accepting the rest of a path component early */
+		GLOBS g = make_globs("a*=1", "ab/*=2", "abc=3");
+		TREE t = make_tree("a", "abcd", "abc", "ab/", "ab/c", "b");
+		assert_matches(g, t, "a=1", "abcd=1", "abc=1", "ab/c=2");
+	}
+	{
+		/* Rejecting by the required suffix */
+		GLOBS g = make_globs("*@UP=1", "*/*@UP=2", "x*/*.c=3");
+		TREE t = make_tree("eth0@UP", "UP", "@U", "lo@DOWN",
+				   "a@UP/", "a@UP/b@UP", "a@UP/c",
+				   "xy/", "xy/z.c", "xy/z.h", "xy/w@UP");
+		assert_matches(g, t, "eth0@UP=1", "a@UP/b@UP=2",
+			       "xy/z.c=3", "xy/w@UP=2");
+	}
+	{
+		/* Generated strings shorter than the required suffix */
+		GLOBS g = make_globs("*/*.c");
+		TREE t = make_tree("x./", "x./c", "x./.c", "x./y.c",
+				   "z/", "z/c");
+		assert_matches(g, t, "x./.c", "x./y.c");
+	}
+	{
+		/* A queue finds the same matches, breadth-first */
+		GLOBS g = make_globs("a*=1", "ab/*=2", "*/*/*=3");
+		TREE t = make_tree("a", "ab/", "ab/c", "ab/d/", "ab/d/e",
+				   "b/", "b/c/", "b/c/d", "abc");
+		Order = MATCHER_FIFO;
+		assert_matches(g, t, "a=1", "ab/c=2", "ab/d/e=3",
+			       "b/c/d=3", "abc=1");
+		Order = MATCHER_LIFO;
+		assert_matches(g, t, "a=1", "ab/c=2", "ab/d/e=3",
+			       "b/c/d=3", "abc=1");
+	}
+	{
+		GLOBS g = make_globs("*", "*/*");
+		TREE t = make_tree("a/", "a/x", "b");
+		struct test_context tctxt = { .tree = t };
+		struct matcher *matcher;
+		str *s1, *s2;
+
+		/* Breadth-first finds the shallow match first */
+		matcher = matcher_new(g, &test_generator, &tctxt);
+		matcher_set_order(matcher, MATCHER_FIFO);
+		s1 = matcher_next(matcher, 0);
+		s2 = matcher_next(matcher, 0);
+		assert(str_eq(s1, "b"));
+		assert(str_eq(s2, "a/x"));
+		assert(!matcher_next(matcher, 0));
+		str_free(s1);
+		str_free(s2);
+		matcher_free(matcher);
+
+		/* Depth-first (the default) finishes the directory first */
+		tctxt.freed = 0;
+		matcher = matcher_new(g, &test_generator, &tctxt);
+		s1 = matcher_next(matcher, 0);
+		s2 = matcher_next(matcher, 0);
+		assert(str_eq(s1, "a/x"));
+		assert(str_eq(s2, "b"));
+		assert(!matcher_next(matcher, 0));
+		str_free(s1);
+		str_free(s2);
+		matcher_free(matcher);
+	}
+	{
+		/* The queue's peak length depends on the traversal */
+		GLOBS g = make_globs("*/*/*");
+		TREE t = make_tree("a/", "a/1/", "a/1/x", "a/2/", "a/2/x",
+				   "b/", "b/1/", "b/1/x", "b/2/", "b/2/x",
+				   "c/", "c/1/", "c/1/x", "c/2/", "c/2/x");
+		static const struct {
+			unsigned order, limit, peak;
+		} policy[] = {
+			{ MATCHER_FIFO, 0, 6 },	/* a/1/ a/2/ b/1/ ... */
+			{ MATCHER_LIFO, 0, 4 },	/* a/1/ a/2/ b/ c/ */
+			{ MATCHER_FIFO, 3, 4 },
+		};
+		unsigned p;
+
+		for (p = 0; p < sizeof policy / sizeof *policy; ++p) {
+			struct test_context tctxt = { .tree = t };
+			struct matcher *matcher;
+			unsigned nresults = 0;
+			str *s;
+
+			matcher = matcher_new(g, &test_generator, &tctxt);
+			matcher_set_order(matcher, policy[p].order);
+			matcher_set_limit(matcher, policy[p].limit);
+			while ((s = matcher_next(matcher, 0))) {
+				nresults++;
+				str_free(s);
+			}
+			assert(nresults == 6);
+			assert(matcher_peak(matcher) == policy[p].peak);
+			matcher_free(matcher);
+		}
+	}
+	{
+		/* Calling back with borrowed strings */
+		GLOBS g = make_globs("a*=1", "ab/*=2", "*/*/*=3");
+		TREE t = make_tree("a", "ab/", "ab/c", "ab/d/", "ab/d/e",
+				   "b/", "b/c/", "b/c/d", "abc");
+		struct test_context tctxt = { .tree = t };
+		struct found_context fc = { "", 0, 0 };
+		struct matcher *matcher;
+		const void *ref;
+		str *s;
+
+		matcher = matcher_new(g, &test_generator, &tctxt);
+		assert(matcher_run(matcher, found, &fc) == 0);
+		assert(strcmp(fc.buf,
+		    "abc=1 ab/c=2 ab/d/e=3 a=1 b/c/d=3 ") == 0);
+		matcher_free(matcher);
+
+		/* Stopping early, then continuing */
+		tctxt.freed = 0;
+		matcher = matcher_new(g, &test_generator, &tctxt);
+		fc.buf[0] = '\0';
+		fc.nfound = 0;
+		fc.stop_at = 2;
+		assert(matcher_run(matcher, found, &fc) == 7);
+		assert(strcmp(fc.buf, "abc=1 ab/c=2 ") == 0);
+		s = matcher_next(matcher, &ref);
+		assert(str_eq(s, "ab/d/e") && strcmp(ref, "3") == 0);
+		str_free(s);
+		fc.stop_at = 0;
+		assert(matcher_run(matcher, found, &fc) == 0);
+		assert(strcmp(fc.buf, "abc=1 ab/c=2 a=1 b/c/d=3 ") == 0);
+		matcher_free(matcher);
+	}
+	{
+		/* Worker threads find the same matches */
+		GLOBS g = make_globs("a*=1", "ab/*=2", "*/*/*=3", "*/*@UP=4");
+		TREE t = make_tree("a", "ab/", "ab/c", "ab/d/", "ab/d/e",
+				   "b/", "b/c/", "b/c/d", "abc", "b/x@UP",
+				   "c/", "c/1/", "c/1/x", "c/2/", "c/2/x");
+		Threads = 4;
+		Ngenerate = 0;
+		assert_matches(g, t, "a=1", "ab/c=2", "ab/d/e=3", "abc=1",
+			       "b/c/d=3", "b/x@UP=4", "c/1/x=3", "c/2/x=3");
+		assert(Ngenerate == 8);
+		Threads = 0;
+	}
+	{
+		/* Freeing a matcher stops its worker threads */
+		GLOBS g = make_globs("*/*/*");
+		TREE t = make_tree("a/", "a/1/", "a/1/x", "a/2/", "a/2/x",
+				   "b/", "b/1/", "b/1/x", "b/2/", "b/2/x");
+		struct test_context tctxt = { .tree = t };
+		struct matcher *matcher;
+		str *s;
+
+		matcher = matcher_new(g, &test_generator, &tctxt);
+		matcher_set_threads(matcher, 3);
+		s = matcher_next(matcher, 0);
+		assert(s);
+		str_free(s);
+		matcher_free(matcher);
+	}
 
 	return 0;
 }
@@ -1,14 +1,100 @@
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "match.h"
 #include "globs.h"
 
+/*
+ * Match records are carved from slabs, and recycled through a free
+ * list instead of being returned to malloc. Each thread has its own
+ * free list; a record freed by another thread joins that thread's list.
+ * A thread that exits gives its free list to the others as spares.
+ */
+#define MATCH_SLAB	256	/* records per slab */
+
+struct match_slab {
+	struct match_slab *next;
+	struct match match[MATCH_SLAB];
+};
+
+static pthread_mutex_t match_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct match_slab *match_slabs;	/* all slabs (match_lock) */
+static struct match *match_spare;	/* spare records (match_lock) */
+static __thread struct match *match_pool;	/* free list */
+
+/*
+ * The leading text shared by all the candidates generated from one
+ * deferred string.
+ */
+struct match_prefix {
+	unsigned refs;		/* (atomic once shared) */
+	unsigned len;		/* str_len(str) */
+	str *str;		/* the deferred's whole string */
+};
+
+static void
+prefix_release(struct match_prefix *prefix)
+{
+	if (prefix &&
+	    !__atomic_sub_fetch(&prefix->refs, 1, __ATOMIC_ACQ_REL))
+	{
+		str_free(prefix->str);
+		free(prefix);
+	}
+}
+
+/* Returns a list of free records, from the spares or from a new slab */
+static struct match *
+match_refill()
+{
+	struct match *list;
+
+	pthread_mutex_lock(&match_lock);
+	if ((list = match_spare)) {
+		match_spare = 0;
+	} else {
+		struct match_slab *slab = malloc(sizeof *slab);
+		unsigned i;
+
+		slab->next = match_slabs;
+		match_slabs = slab;
+		for (i = 0; i < MATCH_SLAB - 1; ++i)
+			slab->match[i].next = &slab->match[i + 1];
+		slab->match[i].next = 0;
+		list = slab->match;
+	}
+	pthread_mutex_unlock(&match_lock);
+	return list;
+}
+
+/* Gives the calling thread's free records to the other threads */
+static void
+match_pool_release()
+{
+	struct match *last;
+
+	if (!match_pool)
+		return;
+	for (last = match_pool; last->next; last = last->next)
+		;
+	pthread_mutex_lock(&match_lock);
+	last->next = match_spare;
+	match_spare = match_pool;
+	pthread_mutex_unlock(&match_lock);
+	match_pool = 0;
+}
 
 struct match *
 match_new(str *str)
 {
-	struct match *match = malloc(sizeof *match);
+	struct match *match = match_pool;
+
+	if (!match)
+		match = match_refill();
+	match_pool = match->next;
 	match->str = str;
 	match->flags = 0;
+	match->prefix = 0;
 	return match;
 }
 
@@ -16,7 +102,124 @@ void
 match_free(struct match *match)
 {
 	str_free(match->str);
-	free(match);
+	prefix_release(match->prefix);
+	match->next = match_pool;
+	match_pool = match;
+}
+
+/*
+ * Returns a new string holding the prefix followed by s, in a segment
+ * of its own. Unlike str_cat(), it leaves the reference counts of the
+ * prefix's segments alone, so that worker threads may share them.
+ */
+static str *
+prefix_cat(const struct match_prefix *prefix, const str *s)
+{
+	unsigned plen = prefix ? prefix->len : 0;
+	unsigned len = plen + str_len(s);
+	char sbuf[256], *buf;
+	str *result;
+
+	buf = len > sizeof sbuf ? malloc(len) : sbuf;
+	if (prefix)
+		str_copy(prefix->str, buf, 0, plen);
+	str_copy(s, buf + plen, 0, len - plen);
+	result = str_newn(buf, len);
+	if (buf != sbuf)
+		free(buf);
+	return result;
+}
+
+/*
+ * Joins a match's prefix onto its string, so that the match holds
+ * the whole candidate string.
+ */
+static void
+match_join(struct match *m)
+{
+	if (m->prefix) {
+		str *whole = prefix_cat(m->prefix, m->str);
+		str_free(m->str);
+		m->str = whole;
+		prefix_release(m->prefix);
+		m->prefix = 0;
+	}
+}
+
+
+/*------------------------------------------------------------
+ * work queues
+ */
+
+/*
+ * A work queue is a growable ring of match pointers. Candidates are
+ * added at the new end, and taken from either end.
+ */
+struct workq {
+	struct match **work;
+	unsigned head;		/* index of the oldest candidate */
+	unsigned count;		/* number of candidates in the queue */
+	unsigned capacity;	/* (a power of 2) */
+};
+
+static void
+workq_push(struct workq *q, struct match *m)
+{
+	if (q->count == q->capacity) {
+		unsigned cap = q->capacity;
+		q->capacity = cap ? 2 * cap : 64;
+		q->work = realloc(q->work, q->capacity * sizeof *q->work);
+		/* Unwrap the ring into the new space */
+		if (q->head + q->count > cap)
+			memcpy(&q->work[cap], q->work,
+			       (q->head + q->count - cap) * sizeof *q->work);
+	}
+	q->work[(q->head + q->count++) & (q->capacity - 1)] = m;
+}
+
+static struct match *
+workq_newest(struct workq *q)
+{
+	return q->work[(q->head + --q->count) & (q->capacity - 1)];
+}
+
+static struct match *
+workq_oldest(struct workq *q)
+{
+	struct match *m = q->work[q->head];
+
+	q->head = (q->head + 1) & (q->capacity - 1);
+	q->count--;
+	return m;
+}
+
+/* Reverses the candidates from index first to the new end */
+static void
+workq_reverse(struct workq *q, unsigned first)
+{
+	const unsigned mask = q->capacity - 1;
+	unsigned i, j;
+
+	if (q->count <= first)
+		return;
+	for (i = first, j = q->count - 1; i < j; ++i, --j) {
+		struct match **a = &q->work[(q->head + i) & mask];
+		struct match **b = &q->work[(q->head + j) & mask];
+		struct match *m = *a;
+		*a = *b;
+		*b = m;
+	}
+}
+
+/* Frees the queued candidates and the queue's storage */
+static void
+workq_clear(struct workq *q)
+{
+	while (q->count)
+		match_free(workq_newest(q));
+	free(q->work);
+	q->work = 0;
+	q->capacity = 0;
 }
 
 
@@ -24,13 +227,45 @@ match_free(struct match *match)
  * matcher
  */
 
+struct pool;
+static unsigned pool_peak(struct pool *pool);
+
+/*
+ * The matcher's work queue is used as a FIFO or as a stack.
+ * When worker threads are running, the queue is idle and
+ * the workers have their own queues in the pool.
+ */
 struct matcher {
 	const struct globs *globs;
 	const struct generator *generator;
 	void *gcontext;
-	struct match *matches;
+	unsigned order;		/* MATCHER_FIFO or MATCHER_LIFO */
+	unsigned limit;		/* count at which to work LIFO, or 0 */
+	unsigned peak;		/* largest count so far */
+	struct workq queue;	/* the queue of candidates */
+	unsigned nthreads;	/* worker threads to start */
+	struct pool *pool;	/* the running workers, or NULL */
 };
 
+/* Appends a candidate to the queue */
+static void
+matcher_push(struct matcher *matcher, struct match *m)
+{
+	workq_push(&matcher->queue, m);
+	if (matcher->queue.count > matcher->peak)
+		matcher->peak = matcher->queue.count;
+}
+
+/* Removes the next candidate to work on from the queue */
+static struct match *
+matcher_pop(struct matcher *matcher)
+{
+	if (matcher->order == MATCHER_LIFO ||
+	    (matcher->limit && matcher->queue.count >= matcher->limit))
+		return workq_newest(&matcher->queue);
+	return workq_oldest(&matcher->queue);
+}
+
 struct matcher *
 matcher_new(const struct globs *globs,
 	    const struct generator *generator,
@@ -39,115 +274,525 @@ matcher_new(const struct globs *globs,
 	struct matcher *matcher;
 	struct match *m;
 
-	/* The initial match list contains the deferred empty string */
+	matcher = malloc(sizeof *matcher);
+	matcher->globs = globs;
+	matcher->generator = generator;
+	matcher->gcontext = context;
+	matcher->order = MATCHER_LIFO;
+	matcher->limit = 0;
+	matcher->peak = 0;
+	memset(&matcher->queue, 0, sizeof matcher->queue);
+	matcher->nthreads = 0;
+	matcher->pool = 0;
+
+	/* The initial queue contains the deferred empty string */
 	m = match_new(0);
 	m->next = 0;
 	m->stri = stri_str(0);
 	m->flags = MATCH_DEFERRED;
 	m->state = 0;
-
-	matcher = malloc(sizeof *matcher);
-	matcher->globs = globs;
-	matcher->generator = generator;
-	matcher->gcontext = context;
-	matcher->matches = m;
+	matcher_push(matcher, m);
 
 	return matcher;
 }
 
+void
+matcher_set_order(struct matcher *matcher, unsigned order)
+{
+	matcher->order = order;
+}
+
+void
+matcher_set_limit(struct matcher *matcher, unsigned limit)
+{
+	matcher->limit = limit;
+}
+
+void
+matcher_set_threads(struct matcher *matcher, unsigned nthreads)
+{
+	matcher->nthreads = nthreads;
+}
+
+unsigned
+matcher_peak(const struct matcher *matcher)
+{
+	return matcher->pool ? pool_peak(matcher->pool) : matcher->peak;
+}
+
+/*
+ * Tests if a candidate string ends with the given bytes.
+ * When the match's own text is shorter than the bytes, the prefix
+ * must end with the rest of them.
+ */
+static int
+match_ends_with(const struct match_prefix *prefix, const str *s,
+		const char *suffix, unsigned suffixlen)
+{
+	char buf[GLOBS_SUFFIX_MAX];
+	unsigned len = str_len(s);
+	unsigned n = len < suffixlen ? len : suffixlen;
+
+	str_copy(s, buf, len - n, n);
+	if (memcmp(buf, suffix + suffixlen - n, n) != 0)
+		return 0;
+	if (n == suffixlen)
+		return 1;
+	suffixlen -= n;
+	if (!prefix || prefix->len < suffixlen)
+		return 0;
+	str_copy(prefix->str, buf, prefix->len - suffixlen, suffixlen);
+	return memcmp(buf, suffix, suffixlen) == 0;
+}
+
 /**
- * Replace an exhausted 'deferred' match with a new list of matches
- * by asking the callback to generate some more.
- */
-static struct match **
-matcher_generate(struct matcher *matcher, struct match **mp, struct match *dm)
-{
-	struct match *m, **tail;
-	unsigned len = str_len(dm->str);
-
-	tail = matcher->generator->generate(mp, dm->str, matcher->gcontext);
-	*tail = 0;
-	for (m = *mp; m; m = m->next) {
-		/* Clone the deferred's state into each new match structure */
-		stri i = stri_str(m->str);
-		stri_inc_by(&i, len);
-		m->stri = i;
+ * Expands an exhausted 'deferred' match by asking the callback to
+ * generate some more.
+ * The deferred's whole string becomes the prefix shared by the
+ * generated matches.
+ * The generated non-deferred strings that lack the suffix required
+ * by the deferred's state are rejected here, without stepping them.
+ *
+ * @returns the list of new matches, in the generator's order
+ */
+static struct match *
+matcher_expand(const struct matcher *matcher, const struct match *dm)
+{
+	struct match *m, *list, **mp;
+	struct match_prefix *prefix = 0;
+	char suffix[GLOBS_SUFFIX_MAX];
+	unsigned suffixlen;
+	str *whole;
+
+	whole = prefix_cat(dm->prefix, dm->str);
+	if (whole) {
+		/* Our reference keeps it until all are prepared */
+		prefix = malloc(sizeof *prefix);
+		prefix->refs = 1;
+		prefix->len = str_len(whole);
+		prefix->str = whole;
+	}
+	suffixlen = globs_state_suffix(matcher->globs, dm->state, suffix);
+	*matcher->generator->generate(&list, whole, matcher->gcontext) = 0;
+	mp = &list;
+	while ((m = *mp)) {
+		if (suffixlen && !(m->flags & MATCH_DEFERRED) &&
+		    !match_ends_with(prefix, m->str, suffix, suffixlen))
+		{
+			*mp = m->next;
+			match_free(m);
+			continue;
+		}
+		/* Clone the deferred's state into each new match structure.
+		 * No other thread can see the prefix yet. */
+		if (prefix)
+			prefix->refs++;
+		m->prefix = prefix;
+		m->stri = stri_str(m->str);
 		m->state = dm->state;
+		mp = &m->next;
 	}
-	return tail;
+	prefix_release(prefix);
+	return list;
+}
+
+/*
+ * Expands a deferred match and queues the new matches.
+ * For a LIFO queue, the strings are queued in reverse, so that they
+ * are still worked on in the generator's order.
+ */
+static void
+matcher_generate(struct matcher *matcher, const struct match *dm)
+{
+	struct match *m, *list;
+	unsigned first = matcher->queue.count;
+
+	list = matcher_expand(matcher, dm);
+	while ((m = list)) {
+		list = m->next;
+		matcher_push(matcher, m);
+	}
+	if (matcher->order == MATCHER_LIFO)
+		workq_reverse(&matcher->queue, first);
+}
+
+/*
+ * Advances a string iterator to the end of its string, unless
+ * a NUL or '/' remains to be matched.
+ * @returns non-zero if the iterator was advanced
+ */
+static int
+skip_to_end(stri *i)
+{
+	stri j = *i;
+
+	for (; stri_more(j); stri_inc(j))
+		if (stri_at(j) == '/' || !stri_at(j))
+			return 0;
+	*i = j;
+	return 1;
+}
+
+/*
+ * Steps a candidate over the rest of its string.
+ * @returns 0 if the candidate was rejected
+ */
+static int
+matcher_step(const struct matcher *matcher, struct match *m)
+{
+	const struct globs *globs = matcher->globs;
+	const int deferred = m->flags & MATCH_DEFERRED;
+	int skip = !deferred;
+
+	while (stri_more(m->stri)) {
+		if (!(globs_state_flags(globs, m->state) & GLOBS_STATE_MORE))
+			return 0;	/* cannot advance to an accept state */
+		if (stri_at(m->stri) == '/' || !stri_at(m->stri))
+			skip = !deferred;
+		if (!globs_step_utf8(globs, &m->stri, &m->state))
+			return 0;
+		if (skip && (globs_state_flags(globs, m->state) &
+			     GLOBS_STATE_ALL))
+		{
+			/* The rest of the string matches if it stays
+			 * in the path component. If it doesn't, don't
+			 * look again until the next component. */
+			if (skip_to_end(&m->stri))
+				break;
+			skip = 0;
+		}
+	}
+	return 1;
+}
+
+
+/*------------------------------------------------------------
+ * worker threads
+ */
+
+/*
+ * Each worker thread expands deferred strings from its own queue,
+ * newest first, and steps the strings generated. A worker whose queue
+ * is empty steals the oldest deferred string from another's queue.
+ * The accepted strings are delivered to matcher_next() in a list.
+ */
+struct worker {
+	const struct matcher *matcher;
+	struct pool *pool;
+	pthread_t thread;
+	pthread_mutex_t lock;	/* protects queue */
+	struct workq queue;	/* stepped deferreds to expand */
+};
+
+struct pool {
+	unsigned nworkers;
+	struct worker *worker;
+	pthread_mutex_t lock;	/* protects the fields below */
+	pthread_cond_t work;	/* signalled when work is queued */
+	pthread_cond_t result;	/* signalled on a result, or when done */
+	unsigned pending;	/* deferreds queued or being expanded */
+	unsigned gen;		/* incremented when work is queued */
+	unsigned peak;		/* largest pending so far */
+	int stop;		/* set by matcher_free() */
+	struct match *results;	/* accepted whole strings */
+	struct match **results_tail;
+};
+
+/* Queues a stepped deferred match for expansion */
+static void
+worker_push(struct worker *worker, struct match *m)
+{
+	struct pool *pool = worker->pool;
+
+	/* Count it first, so that pending cannot reach 0 while it
+	 * is visible to other workers */
+	pthread_mutex_lock(&pool->lock);
+	if (++pool->pending > pool->peak)
+		pool->peak = pool->pending;
+	pool->gen++;
+	pthread_mutex_lock(&worker->lock);
+	workq_push(&worker->queue, m);
+	pthread_mutex_unlock(&worker->lock);
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Steps a candidate, then queues it to be expanded if it is deferred,
+ * or delivers it if it is accepted.
+ */
+static void
+worker_dispatch(struct worker *worker, struct match *m)
+{
+	const struct globs *globs = worker->matcher->globs;
+	struct pool *pool = worker->pool;
+
+	if (!matcher_step(worker->matcher, m)) {
+		match_free(m);
+	} else if (m->flags & MATCH_DEFERRED) {
+		if (globs_state_flags(globs, m->state) & GLOBS_STATE_MORE)
+			worker_push(worker, m);
+		else
+			match_free(m);
+	} else if (globs_is_accept_state(globs, m->state)) {
+		match_join(m);
+		m->next = 0;
+		pthread_mutex_lock(&pool->lock);
+		*pool->results_tail = m;
+		pool->results_tail = &m->next;
+		pthread_cond_signal(&pool->result);
+		pthread_mutex_unlock(&pool->lock);
+	} else {
+		match_free(m);
+	}
+}
+
+/*
+ * Takes a deferred to expand, from the worker's own queue or
+ * from another's, waiting for one if necessary.
+ * @returns NULL when there is no more work
+ */
+static struct match *
+worker_take(struct worker *worker)
+{
+	struct pool *pool = worker->pool;
+	unsigned w = worker - pool->worker;
+	struct match *m = 0;
+	unsigned gen, i;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop && pool->pending) {
+		gen = pool->gen;
+		pthread_mutex_unlock(&pool->lock);
+		for (i = 0; !m && i < pool->nworkers; ++i) {
+			struct worker *v = &pool->worker[
+				(w + i) % pool->nworkers];
+			pthread_mutex_lock(&v->lock);
+			if (v->queue.count)
+				m = i ? workq_oldest(&v->queue)
+				      : workq_newest(&v->queue);
+			pthread_mutex_unlock(&v->lock);
+		}
+		if (m)
+			return m;
+		pthread_mutex_lock(&pool->lock);
+		while (gen == pool->gen && pool->pending && !pool->stop)
+			pthread_cond_wait(&pool->work, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+static void *
+worker_run(void *arg)
+{
+	struct worker *worker = arg;
+	struct pool *pool = worker->pool;
+	struct match *dm, *m, *list;
+
+	while ((dm = worker_take(worker))) {
+		list = matcher_expand(worker->matcher, dm);
+		match_free(dm);
+		while ((m = list)) {
+			list = m->next;
+			worker_dispatch(worker, m);
+		}
+		pthread_mutex_lock(&pool->lock);
+		if (!--pool->pending) {
+			pthread_cond_broadcast(&pool->work);
+			pthread_cond_broadcast(&pool->result);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+	match_pool_release();
+	return 0;
+}
+
+/*
+ * Starts the worker threads, giving the matcher's queued
+ * candidates to the first worker.
+ */
+static void
+pool_start(struct matcher *matcher)
+{
+	struct pool *pool = malloc(sizeof *pool);
+	unsigned i;
+
+	pool->nworkers = matcher->nthreads;
+	pool->worker = calloc(pool->nworkers, sizeof *pool->worker);
+	pthread_mutex_init(&pool->lock, 0);
+	pthread_cond_init(&pool->work, 0);
+	pthread_cond_init(&pool->result, 0);
+	pool->pending = 0;
+	pool->gen = 0;
+	pool->peak = 0;
+	pool->stop = 0;
+	pool->results = 0;
+	pool->results_tail = &pool->results;
+	for (i = 0; i < pool->nworkers; ++i) {
+		pool->worker[i].matcher = matcher;
+		pool->worker[i].pool = pool;
+		pthread_mutex_init(&pool->worker[i].lock, 0);
+	}
+	while (matcher->queue.count)
+		worker_dispatch(&pool->worker[0],
+				workq_oldest(&matcher->queue));
+	for (i = 0; i < pool->nworkers; ++i)
+		pthread_create(&pool->worker[i].thread, 0, worker_run,
+			       &pool->worker[i]);
+	matcher->pool = pool;
+}
+
+/* Waits for the next result from the workers */
+static struct match *
+pool_next(struct pool *pool)
+{
+	struct match *m;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->results && pool->pending)
+		pthread_cond_wait(&pool->result, &pool->lock);
+	if ((m = pool->results) && !(pool->results = m->next))
+		pool->results_tail = &pool->results;
+	pthread_mutex_unlock(&pool->lock);
+	return m;
+}
+
+static unsigned
+pool_peak(struct pool *pool)
+{
+	unsigned peak;
+
+	pthread_mutex_lock(&pool->lock);
+	peak = pool->peak;
+	pthread_mutex_unlock(&pool->lock);
+	return peak;
+}
+
+/* Stops the worker threads and frees the pool */
+static void
+pool_free(struct pool *pool)
+{
+	struct match *m;
+	unsigned i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nworkers; ++i)
+		pthread_join(pool->worker[i].thread, 0);
+	for (i = 0; i < pool->nworkers; ++i) {
+		workq_clear(&pool->worker[i].queue);
+		pthread_mutex_destroy(&pool->worker[i].lock);
+	}
+	while ((m = pool->results)) {
+		pool->results = m->next;
+		match_free(m);
+	}
+	pthread_cond_destroy(&pool->result);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->worker);
+	free(pool);
+}
+
+
+/*------------------------------------------------------------
+ * matcher results
+ */
+
+/*
+ * Works through the queue until a candidate is accepted, or takes
+ * the next candidate accepted by the worker threads.
+ * @returns the accepted match, or NULL when there are no more
+ */
+static struct match *
+matcher_find(struct matcher *matcher)
+{
+	struct match *m;
+
+	if (!matcher->pool && matcher->nthreads > 1 &&
+	    globs_is_shareable(matcher->globs))
+		pool_start(matcher);
+	if (matcher->pool)
+		return pool_next(matcher->pool);
+
+	while (matcher->queue.count) {
+		m = matcher_pop(matcher);
+		if (!matcher_step(matcher, m)) {
+			match_free(m);
+		} else if (m->flags & MATCH_DEFERRED) {
+			/* Nothing generated from the deferred string
+			 * could match unless the state can advance */
+			if (globs_state_flags(matcher->globs, m->state) &
+			    GLOBS_STATE_MORE)
+				matcher_generate(matcher, m);
+			match_free(m);
+		} else if (globs_is_accept_state(matcher->globs, m->state)) {
+			/* It's real */
+			return m;
+		} else {
+			/* Not a match; reject */
+			match_free(m);
+		}
+	}
+	return 0;
 }
 
 str *
 matcher_next(struct matcher *matcher, const void **ref_return)
 {
-	struct match *m, **mp;
-
-	while (matcher->matches) {
-		/* Process all the exhausted strings */
-		mp = &matcher->matches;
-		while ((m = *mp)) {
-			if (stri_more(m->stri)) {
-				/* Advance the match candidate's state */
-				unsigned ch = stri_utf8_inc(&m->stri);
-				if (!globs_step(matcher->globs, ch, &m->state)){
-					/* Failed to advance; reject it */
-					*mp = m->next;
-					match_free(m);
-				}
-			} else if (m->flags & MATCH_DEFERRED) {
-				/* The string is exhausted, but it's
-				 * a deferred string; so expand it now */
-				struct match *head, **tail;
-
-				tail = matcher_generate(matcher, &head, m);
-
-				/* Remove the current match (m),
-				 * replacing it with the head..tail that
-				 * was just generated. We don't return m. */
-				*tail = m->next;
-				*mp = head;
-				match_free(m);
-			} else {
-				/* Found a real, exhausted string.
-				 * First, remove it from the list */
-				*mp = m->next;
-
-				/* Next, test if it's a real match */
-				const void *ref = globs_is_accept_state(
-					matcher->globs, m->state);
-				if (ref) {
-					/* It's real.
-					 * Steal the match.str before freeing */
-					str *result = m->str;
-					m->str = 0;
-					match_free(m);
-					if (ref_return) {
-						*ref_return = ref;
-					}
-					return result;
-				} else {
-					/* Not a match; reject */
-					match_free(m);
-				}
-			}
+	struct match *m;
+	str *result;
+
+	if (!(m = matcher_find(matcher)))
+		return 0;
+	if (ref_return)
+		*ref_return = globs_is_accept_state(matcher->globs, m->state);
+	/* Steal the whole match.str before freeing */
+	match_join(m);
+	result = m->str;
+	m->str = 0;
+	match_free(m);
+	return result;
+}
+
+int
+matcher_run(struct matcher *matcher,
+	    int (*found)(const str *s, const void *ref, void *context),
+	    void *context)
+{
+	struct match *m;
+	str head;
+	int ret = 0;
+
+	while (!ret && (m = matcher_find(matcher))) {
+		const str *s = m->str;
+
+		if (m->prefix) {
+			/* Borrow the prefix's single segment, and
+			 * chain it to the match's string */
+			head = *m->prefix->str;
+			head.next = m->str;
+			s = &head;
 		}
+		ret = found(s, globs_is_accept_state(matcher->globs,
+						     m->state), context);
+		match_free(m);
 	}
-	return 0;
+	return ret;
 }
 
 void
 matcher_free(struct matcher *matcher)
 {
-	struct match *m, *mnext;
-
+	if (matcher->pool) {
+		pool_free(matcher->pool);
+	}
 	if (matcher->generator->free) {
 	    matcher->generator->free(matcher->gcontext);
 	}
-	mnext = matcher->matches;
-	while ((m = mnext)) {
-		mnext = m->next;
-		match_free(m);
-	}
+	workq_clear(&matcher->queue);
 	free(matcher);
 }
-
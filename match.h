@@ -27,10 +27,10 @@
  * trailing ... means a 'defer point', and the digit 0 indicates
  * the caret state relative to a glob set's DFA.
  *
- * On the first iteration the matcher steps the pattern h*.txt over all
- * the strings. A pattern iterator is an automaton state, one is created
- * for each generated string. They are each stepped according to where
- * the caret is.
+ * The generated strings are the matcher's work queue. The matcher takes
+ * one element at a time from the queue, and steps the pattern h*.txt
+ * over its string, from the caret, as far as it will go. A pattern
+ * iterator is an automaton state, one for each element.
  *                  ╭┬───┬───┬───╮
  *                  ↓?   ?   ?   ?
  *             →○─h→○┴.→○┴t→○┴x→○┴t→●
@@ -38,67 +38,65 @@
  *
  * The pattern automaton in its initial state will only transition on 'h',
  * and any other charater will be 'rejected'.  Rejection is used by the
- * matcher to discard immediately candidate strings.
+ * matcher to discard immediately candidate strings. So hello.txt steps
+ * through states 1, 1, 1, 1, 1, 2, 3, 4 and 5:
  *
- * After stepping each automaton (patterni) by one character for each
- * element in the generated list, elements can be removed. The list in our
- * example then reduces to:
- *       1          1
- *    [ h^ello.txt h^a.c ]
- *
- * The next step, roughly corresponding to the wildcard '*', only moves
- * the caret through '?' (any char) edges.
- *        1          1
- *    [ he^llo.txt ha^.c ]
- *
- *         1          2
- *    [ hel^lo.txt ha.^c ]
- *
- *          1          1
- *    [ hell^o.txt ha.c^ ]
- *
- * On the next step, the ha.c element will be at the end of its string, so
- * it is checked to see in an accepting state. Only state 5 is an accepting
- * state in the DFA. So, ha.c is rejected and removed from the list.
+ *               5
+ *    [ hello.txt^ ha.c subdir subdir/... /... ]
  *
- * Had the string ha.c been marked "deferred", its element would be replaced
- * with those strings from another call to the generator. That could have
- * happend had ha.c been a directory pathname.
+ * An undeferred string that reaches its end in an accept state is
+ * removed from the queue, and returned as a result from #matcher_next().
+ * Next, ha.c steps through states 1, 1, 2 and 1. Only state 5 is an
+ * accepting state in the DFA, so ha.c is rejected and removed, and
+ * subdir is rejected at its first character.
  *
- * The filtering continues until an element reaches end-of-string:
+ * Had the string ha.c been marked "deferred", it would have been replaced
+ * in the queue by the strings from another call to the generator. That
+ * could have happend had ha.c been a directory pathname. The new
+ * strings continue from the deferred's caret and state.
  *
- *            2
- *    [ hello.^txt ]
- *             3
- *    [ hello.t^xt ]
- *               4
- *    [ hello.tx^t ]
- *               5
- *    [ hello.txt^ ]
+ * The queue is a stack by default, which visits a tree of directories
+ * depth first. With #MATCHER_FIFO, it is first-in first-out, which
+ * visits the tree breadth first. Either way, the results come out in an
+ * order determined by the generator's order. #matcher_set_limit() bounds
+ * a breadth first queue by going depth first while the queue is long.
  *
- * A undeferred member string successfully reaching an accept state is then
- * removed from the list, and returned as a result from #matcher_next().
+ * The matcher also consults #globs_state_flags(). Elements whose state
+ * can accept nothing longer are rejected without stepping further, and
+ * such deferreds are discarded without calling the generator, so that
+ * only the subtrees the globs can reach are generated. Once an element's
+ * state accepts whatever follows in its path component, the rest of the
+ * string is skipped. Newly generated undeferred strings that do not end
+ * with the deferred state's #globs_state_suffix() are rejected before
+ * any of them is stepped.
  */
 struct matcher;
 
 struct globs; /* forward decl */
 
+struct match_prefix; /* opaque */
+
 /**
  * A match is a partially-matched candidate string.
  * These structures are allocated by the generator callback implementation.
+ * The candidate string is the concatenation of the prefix it was
+ * generated from and its #match.str. The prefix is shared by reference
+ * between all the candidates generated from it.
  */
 struct match {
 	struct match *next;
-	str *str;		/**< candidate string, UTF-8 encoded (owned) */
+	str *str;		/**< text after the prefix, UTF-8 (owned) */
 	unsigned flags;
 #define MATCH_DEFERRED	1	/**< flags: generator can yield more strings */
 	stri stri;		/**< position of next character to match */
 	unsigned state;		/**< current match state */
+	struct match_prefix *prefix; /**< leading text (set by matcher) */
 };
 
 /**
- * Allocates a new match structure.
- * Only the #match.flags and #match.str fields are initialized.
+ * Allocates a new match structure from a pool.
+ * Only the #match.flags, #match.str and #match.prefix fields are
+ * initialized.
  *
  * @param str  the UTF-8 string in the match (TAKEN)
  *
@@ -107,7 +105,8 @@ struct match {
 struct match *match_new(str *str);
 
 /**
- * Deallocates a match structure.
+ * Returns a match structure to the pool, releasing its string and
+ * its reference to its prefix.
  *
  * @param match the match structure to release
  */
@@ -125,9 +124,9 @@ struct generator {
 	 * chain them via their #match.next fields, and insert them
 	 * into the list indicated by the @a mp parameter.
 	 *
-	 * Each returned match must have a #match.str field that is:
-	 *   1. longer then @a prefix
-	 *   2. starts with the same characters as @a prefix
+	 * Each returned match must have a #match.str field that is
+	 * the non-empty text that follows @a prefix in the candidate.
+	 * The matcher joins it to @a prefix without copying either.
 	 *
 	 * The #match.flags field must be set to 0 or MATCH_DEFERRED.
 	 * The #match.stri field may be left uninitialized.
@@ -137,7 +136,8 @@ struct generator {
 	 *
 	 * The MATCH_DEFERRED bit in #match.flags indicates that this
 	 * function should be called again to provided more strings.
-	 * Such a call will have #match.str passed as the @a prefix
+	 * Such a call will have the whole candidate string, the
+	 * earlier prefix followed by #match.str, passed as the @a prefix
 	 * parameter.
 	 *
 	 * @param mp      address of a #match.next field into which to
@@ -178,6 +178,69 @@ struct matcher *matcher_new(const struct globs *globs,
 			    const struct generator *generator,
 			    void *gcontext);
 
+/**
+ * Selects the order in which the matcher works through its queue of
+ * candidate strings. This should be called before #matcher_next().
+ *
+ * @param matcher  the matcher
+ * @param order    #MATCHER_LIFO (the default) to expand deferred
+ *                 strings depth first, or #MATCHER_FIFO to expand
+ *                 them breadth first. Depth first keeps fewer
+ *                 candidates in the queue when the tree is wide.
+ */
+void matcher_set_order(struct matcher *matcher, unsigned order);
+#define MATCHER_LIFO	0
+#define MATCHER_FIFO	1
+
+/**
+ * Bounds the matcher's queue of candidate strings. While the queue
+ * holds @a limit or more candidates, the matcher works depth first,
+ * whatever its order, finishing the most recently generated strings
+ * before it expands any older deferred string. The queue then grows
+ * past the limit by at most the entries of one directory per level
+ * of the tree.
+ *
+ * A depth first matcher needs no limit; its queue holds only the
+ * unvisited siblings of the directories on the current path.
+ *
+ * @param matcher  the matcher
+ * @param limit    the queue length at which to go depth first,
+ *                 or 0 for no limit (the default)
+ */
+void matcher_set_limit(struct matcher *matcher, unsigned limit);
+
+/**
+ * Has the matcher expand deferred strings in worker threads.
+ * Each worker expands deferred strings from its own queue, depth
+ * first, and steps the strings generated. A worker with nothing to do
+ * steals the oldest deferred string from another worker's queue, so
+ * that the workers overlap their generators' waits for I/O. The
+ * accepted strings are delivered to #matcher_next() as they are found,
+ * in no particular order. The order and limit are not used.
+ *
+ * The generator's #generator.generate function must then be safe to
+ * call from several threads at once, and the strings it generates must
+ * not share segments with each other or with the prefix. If the globs are not
+ * #globs_is_shareable(), the matcher works without threads.
+ * This should be called before #matcher_next().
+ *
+ * @param matcher   the matcher
+ * @param nthreads  the number of worker threads, or 0 or 1 for none
+ *                  (the default)
+ */
+void matcher_set_threads(struct matcher *matcher, unsigned nthreads);
+
+/**
+ * Reports the most candidate strings that the matcher's queue has
+ * held at once. This is a measure of the memory used by the matcher.
+ * With worker threads, it counts the deferred strings queued.
+ *
+ * @param matcher  the matcher
+ *
+ * @returns the peak length of the queue
+ */
+unsigned matcher_peak(const struct matcher *matcher);
+
 /**
  * Searches the generated string space to find the string that matches
  * a pattern from the globset.
@@ -191,6 +254,30 @@ struct matcher *matcher_new(const struct globs *globs,
  */
 str *matcher_next(struct matcher *matcher, const void **ref_return);
 
+/**
+ * Searches the generated string space, calling back with each string
+ * that matches a pattern from the globset, until the callback returns
+ * non-zero. The matcher may be run again, or #matcher_next() called,
+ * to continue after the string that stopped it.
+ *
+ * The string given to the callback is borrowed, and is only valid
+ * during the call; #str_dup() it to keep it. Unlike with
+ * #matcher_next(), no string is allocated for a result, except by
+ * worker threads (see #matcher_set_threads()).
+ *
+ * @param matcher  the matcher
+ * @param found    the callback, given the matching string, the glob's
+ *                 associated reference and @a context. It returns
+ *                 non-zero to stop the matcher.
+ * @param context  the context argument for @a found
+ *
+ * @returns the non-zero value returned by @a found, or
+ *          0 when the generator is exhausted.
+ */
+int matcher_run(struct matcher *matcher,
+		int (*found)(const str *s, const void *ref, void *context),
+		void *context);
+
 /**
  * Releases storage associated with a matcher.
  *
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "nfa.h"
+#include "cclass.h"
+
+/* Benchmark for subset construction over many character classes */
+
+#define NWORDS	100	/* alternatives in the NFA */
+#define WORDLEN	6	/* character classes per alternative */
+#define NRANGES	2	/* intervals per character class */
+#define NROUNDS	10	/* times to repeat the construction */
+
+static unsigned seed = 1;
+
+/* Returns a pseudo-random number in [0,n) */
+static unsigned
+rnd(unsigned n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+/* Returns a character class of NRANGES random ranges */
+static cclass *
+random_cclass()
+{
+	cclass *cc = cclass_new();
+	unsigned i;
+
+	for (i = 0; i < NRANGES; ++i) {
+		unsigned lo = 'a' + rnd(26);
+		cclass_add(cc, lo, lo + 1 + rnd(2));
+	}
+	if (rnd(4) == 0)
+		cclass_add(cc, 0x3b1 + rnd(16), 0x3c1 + rnd(16));
+	return cc;
+}
+
+/*
+ * Builds an NFA that matches any of NWORDS sequences
+ * of random character classes.
+ */
+static void
+build(struct nfa *nfa)
+{
+	unsigned w, i, last, next;
+
+	nfa_init(nfa);
+	nfa_new_node(nfa);
+	for (w = 0; w < NWORDS; ++w) {
+		last = 0;
+		for (i = 0; i < WORDLEN; ++i) {
+			next = nfa_new_node(nfa);
+			nfa_new_edge(nfa, last, next)->cclass =
+				random_cclass();
+			last = next;
+		}
+		nfa_add_final(nfa, last, nfa);
+	}
+}
+
+/* Returns the current time in seconds */
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int
+main()
+{
+	struct nfa nfa;
+	unsigned r, nstates = 0;
+	double t, total = 0;
+
+	for (r = 0; r < NROUNDS; ++r) {
+		seed = 1;
+		build(&nfa);
+		t = now();
+		nfa_to_dfa(&nfa);
+		total += now() - t;
+		nstates = nfa.nnodes;
+		nfa_fini(&nfa);
+	}
+	printf("%-8s %-16s %10.3f ms (%u states)\n", "dfa", "nfa_to_dfa",
+		total / NROUNDS * 1e3, nstates);
+	return 0;
+}
@@ -383,6 +383,49 @@ main()
 		assert(!dfa_matches(dfa, "abca"));
 		nfa_free(dfa);
 	}
+	{
+		/* nfa_freeze() packs edges and finals contiguously */
+		struct nfa *dfa;
+		const struct edge *edge;
+		const void **final;
+		unsigned i, j, a;
+		MAKE_DFA(dfa, "ab|ac*|b");
+
+		assert(dfa->pool);
+		edge = dfa->pool;
+		for (i = 0; i < dfa->nnodes; ++i) {
+			assert(!dfa->nodes[i].nedges ||
+			       dfa->nodes[i].edges == edge);
+			edge += dfa->nodes[i].nedges;
+		}
+		final = (const void **)edge;
+		for (i = 0; i < dfa->nnodes; ++i) {
+			assert(!dfa->nodes[i].nfinals ||
+			       dfa->nodes[i].finals == final);
+			final += dfa->nodes[i].nfinals;
+		}
+
+		/* adding to a frozen graph thaws it */
+		a = nfa_new_node(dfa);
+		assert(!dfa->pool);
+		nfa_add_final(dfa, a, "x");
+		for (i = 0; i < 40; ++i) {
+			cclass *cc = cclass_new();
+			cclass_add(cc, 'x' + i, 'x' + i + 1);
+			nfa_new_edge(dfa, 0, a)->cclass = cc;
+		}
+		assert(dfa_matches(dfa, "ab"));
+		assert(dfa_matches(dfa, "acc"));
+		assert(dfa_matches(dfa, "x"));
+		assert(!dfa_matches(dfa, "bb"));
+		nfa_freeze(dfa);
+		assert(dfa->pool);
+		for (j = 0; j < dfa->nodes[0].nedges; ++j)
+			assert(dfa->nodes[0].edges[j].cclass);
+		assert(dfa_matches(dfa, "x"));
+		assert(dfa_matches(dfa, "ac"));
+		nfa_free(dfa);
+	}
 
 	return 0;
 }
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "nfa.h"
 #include "bitset.h"
 
@@ -13,6 +14,7 @@ nfa_init(struct nfa *nfa)
 {
 	nfa->nnodes = 0;
 	nfa->nodes = 0;
+	nfa->pool = 0;
 	return nfa;
 }
 
@@ -25,12 +27,114 @@ nfa_fini(struct nfa *nfa)
 		for (j = 0; j < n->nedges; ++j) {
 			cclass_free(n->edges[j].cclass);
 		}
-		free(n->edges);
-		free(n->finals);
+		if (!nfa->pool) {
+			free(n->edges);
+			free(n->finals);
+		}
 	}
+	free(nfa->pool);
 	free(nfa->nodes);
 	nfa->nodes = 0;
 	nfa->nnodes = 0;
+	nfa->pool = 0;
+}
+
+/*
+ * The arrays of a graph under construction grow geometrically.
+ * An array of n elements has a capacity of 0 when n is 0, otherwise
+ * it is the least inc*2^k >= n.
+ */
+
+/* Returns the capacity of an array holding n elements */
+static unsigned
+capacity(unsigned n, unsigned inc)
+{
+	unsigned cap = inc;
+
+	if (!n)
+		return 0;
+	while (cap < n)
+		cap *= 2;
+	return cap;
+}
+
+/* Ensures there is room to append to an array of n elements */
+static void *
+grow(void *array, unsigned n, unsigned inc, size_t size)
+{
+	if (n % inc == 0 && (n < inc || !(n & (n - 1))))
+		array = realloc(array, (n ? 2 * n : inc) * size);
+	return array;
+}
+
+void
+nfa_freeze(struct nfa *nfa)
+{
+	unsigned i, nedges = 0, nfinals = 0;
+	struct edge *edge;
+	const void **final;
+
+	if (nfa->pool)
+		return;
+	for (i = 0; i < nfa->nnodes; ++i) {
+		nedges += nfa->nodes[i].nedges;
+		nfinals += nfa->nodes[i].nfinals;
+	}
+	if (!nedges && !nfinals)
+		return;
+
+	/* The edges come first, then the finals */
+	nfa->pool = malloc(nedges * sizeof *edge + nfinals * sizeof *final);
+	edge = nfa->pool;
+	final = (const void **)(edge + nedges);
+	for (i = 0; i < nfa->nnodes; ++i) {
+		struct node *n = &nfa->nodes[i];
+
+		if (n->nedges)
+			memcpy(edge, n->edges, n->nedges * sizeof *edge);
+		free(n->edges);
+		n->edges = edge;
+		edge += n->nedges;
+		if (n->nfinals)
+			memcpy(final, n->finals, n->nfinals * sizeof *final);
+		free(n->finals);
+		n->finals = final;
+		final += n->nfinals;
+	}
+	nfa->nodes = realloc(nfa->nodes, nfa->nnodes * sizeof *nfa->nodes);
+}
+
+/* Returns a frozen graph to separately allocated, growable arrays */
+static void
+nfa_thaw(struct nfa *nfa)
+{
+	unsigned i;
+
+	if (!nfa->pool)
+		return;
+	nfa->nodes = realloc(nfa->nodes,
+		capacity(nfa->nnodes, NODEINC) * sizeof *nfa->nodes);
+	for (i = 0; i < nfa->nnodes; ++i) {
+		struct node *n = &nfa->nodes[i];
+		struct edge *edges = n->edges;
+		const void **finals = n->finals;
+
+		n->edges = 0;
+		n->finals = 0;
+		if (n->nedges) {
+			n->edges = malloc(capacity(n->nedges, TRANSINC) *
+					  sizeof *n->edges);
+			memcpy(n->edges, edges, n->nedges * sizeof *n->edges);
+		}
+		if (n->nfinals) {
+			n->finals = malloc(capacity(n->nfinals, FINALINC) *
+					   sizeof *n->finals);
+			memcpy(n->finals, finals,
+			       n->nfinals * sizeof *n->finals);
+		}
+	}
+	free(nfa->pool);
+	nfa->pool = 0;
 }
 
 struct nfa *
@@ -58,10 +162,10 @@ unsigned
 nfa_new_node(struct nfa *nfa)
 {
 	unsigned i;
-	if ((nfa->nnodes % NODEINC) == 0) {
-		nfa->nodes = realloc(nfa->nodes,
-			(nfa->nnodes + NODEINC) * sizeof *nfa->nodes);
-	}
+
+	nfa_thaw(nfa);
+	nfa->nodes = grow(nfa->nodes, nfa->nnodes, NODEINC,
+			  sizeof *nfa->nodes);
 	i = nfa->nnodes++;
 	memset(&nfa->nodes[i], 0, sizeof nfa->nodes[i]);
 	return i;
@@ -70,12 +174,12 @@ nfa_new_node(struct nfa *nfa)
 struct edge *
 nfa_new_edge(struct nfa *nfa, unsigned from, unsigned to)
 {
-	struct node *n = &nfa->nodes[from];
+	struct node *n;
 	struct edge *edge;
-	if (n->nedges % TRANSINC == 0) {
-		n->edges = realloc(n->edges,
-			(n->nedges + TRANSINC) * sizeof *n->edges);
-	}
+
+	nfa_thaw(nfa);
+	n = &nfa->nodes[from];
+	n->edges = grow(n->edges, n->nedges, TRANSINC, sizeof *n->edges);
 	edge = &n->edges[n->nedges++];
 	edge->cclass = 0;
 	edge->dest = to;
@@ -93,10 +197,9 @@ nfa_add_final(struct nfa *nfa, unsigned i, const void *final)
 		if (n->finals[j] == final)
 			return;
 
-	if (n->nfinals % FINALINC == 0) {
-		n->finals = realloc(n->finals,
-			(n->nfinals + FINALINC) * sizeof *n->finals);
-	}
+	nfa_thaw(nfa);
+	n = &nfa->nodes[i];
+	n->finals = grow(n->finals, n->nfinals, FINALINC, sizeof *n->finals);
 	n->finals[n->nfinals++] = final;
 }
 
@@ -147,8 +250,13 @@ struct equiv {
 	const struct nfa *nfa;
 	unsigned max, avail;
 	bitset **set;
+	unsigned hashsz;	/* a power of 2, or 0 */
+	unsigned *hash;		/* DFA nodes by set, or EQUIV_NONE */
 };
 
+/* An empty slot in the equiv hash table */
+#define EQUIV_NONE (~0u)
+
 static void
 equiv_init(struct equiv *equiv, const struct nfa *nfa)
 {
@@ -156,6 +264,8 @@ equiv_init(struct equiv *equiv, const struct nfa *nfa)
 	equiv->max = 0;
 	equiv->avail = 0;
 	equiv->set = 0;
+	equiv->hashsz = 0;
+	equiv->hash = 0;
 }
 
 /*
@@ -189,28 +299,53 @@ equiv_cleanup(struct equiv *equiv) {
 	for (i = 0; i < equiv->max; ++i)
 		bitset_free(equiv->set[i]);
 	free(equiv->set);
+	free(equiv->hash);
+}
+
+/* Doubles the hash table of the equiv map's sets */
+static void
+equiv_rehash(struct equiv *equiv)
+{
+	unsigned h, i;
+
+	equiv->hashsz = equiv->hashsz ? 2 * equiv->hashsz : 64;
+	free(equiv->hash);
+	equiv->hash = malloc(equiv->hashsz * sizeof *equiv->hash);
+	for (i = 0; i < equiv->hashsz; ++i)
+		equiv->hash[i] = EQUIV_NONE;
+	for (i = 0; i < equiv->max; ++i) {
+		h = bitset_hash(equiv->set[i]);
+		while (equiv->hash[h & (equiv->hashsz - 1)] != EQUIV_NONE)
+			h++;
+		equiv->hash[h & (equiv->hashsz - 1)] = i;
+	}
 }
 
 /*
  * Find (or create new) an equivalent DFA state for a given
  * set of NFA nodes.
- * Searches the equiv map for the bitset bs.
+ * Searches the equiv map's hash table for the bitset bs.
  * Note that this may add nodes to the DFA.
  */
 static unsigned
 equiv_lookup(struct nfa *dfa, struct equiv *equiv, const bitset *bs)
 {
-	unsigned i, j, n;
+	unsigned i, j, n, h;
+
+	if (2 * (equiv->max + 1) > equiv->hashsz)
+		equiv_rehash(equiv);
 
 	/* Check to see if we've already constructed the equivalent-node */
-	for (i = 0; i < equiv->max; ++i) {
-		if (equiv->set[i] && bitset_cmp(equiv->set[i], bs) == 0) {
+	h = bitset_hash(bs);
+	while ((i = equiv->hash[h & (equiv->hashsz - 1)]) != EQUIV_NONE) {
+		if (bitset_cmp(equiv->set[i], bs) == 0)
 			return i;
-		}
+		h++;
 	}
 
 	/* Haven't seen that NFA set before, so let's allocate a DFA node */
 	n = nfa_new_node(dfa);
+	equiv->hash[h & (equiv->hashsz - 1)] = n;
 
 	/* Merge the set of final pointers */
 	bitset_for(j, bs) {
@@ -224,14 +359,50 @@ equiv_lookup(struct nfa *dfa, struct equiv *equiv, const bitset *bs)
 	return n;
 }
 
-/* Unsigned integer comparator for qsort */
-static int
-unsigned_cmp(const void *a, const void *b)
+/*
+ * A cursor over the bounds of a cclass, which are in sorted order:
+ *    interval[0].lo, interval[0].hi, interval[1].lo, ...
+ */
+struct bounds_cursor {
+	const cclass *cc;
+	unsigned pos;		/* index into the bounds */
+};
+
+/* Returns the bound under a cursor */
+static inline unsigned
+cursor_bound(const struct bounds_cursor *c)
 {
-	unsigned aval = *(const unsigned *)a;
-	unsigned bval = *(const unsigned *)b;
+	return (c->pos & 1) ? c->cc->interval[c->pos / 2].hi
+			    : c->cc->interval[c->pos / 2].lo;
+}
 
-	return aval < bval ? -1 : aval > bval;
+/* Working storage for #cclass_breaks(), which holds its result */
+struct breaks {
+	unsigned *breaks, breakscap;
+	struct bounds_cursor *heap;
+	unsigned heapcap;
+};
+
+/* Restores the min-heap order of heap[0..n) below heap[i] */
+static void
+heap_sift_down(struct bounds_cursor *heap, unsigned n, unsigned i)
+{
+	struct bounds_cursor c = heap[i];
+	const unsigned v = cursor_bound(&c);
+
+	for (;;) {
+		unsigned child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n &&
+		    cursor_bound(&heap[child + 1]) < cursor_bound(&heap[child]))
+			child++;
+		if (v <= cursor_bound(&heap[child]))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = c;
 }
 
 /*
@@ -246,71 +417,212 @@ unsigned_cmp(const void *a, const void *b)
  *
  *     {p,q,t,u,z}
  *
+ * The bounds of each cclass are already sorted, so they are
+ * combined with a k-way merge through a min-heap of cursors.
+ *
  * @param nfa            the graph from which to draw the nodes
  * @param nodes          the set of nodes from which to draw the cclasses
+ * @param b              working storage, which holds the result
  * @param nbreaks_return where to store the length of the returned set
- * @return the array of breakpoints.
+ * @return the array of breakpoints, owned by @a b.
  */
-static unsigned *
+static const unsigned *
 cclass_breaks(const struct nfa *nfa, const bitset *nodes,
-	      unsigned *nbreaks_return)
+	      struct breaks *b, unsigned *nbreaks_return)
 {
-	unsigned ni;
-	unsigned i, j;
+	unsigned ni, j, k = 0, nbounds = 0, nbreaks = 0;
 
-	/* Count the number of intervals */
-	unsigned nintervals = 0;
+	/* Make a heap of cursors, one per non-empty cclass */
 	bitset_for(ni, nodes) {
 		const struct node *n = &nfa->nodes[ni];
 		for (j = 0; j < n->nedges; ++j) {
 			const cclass *cc = n->edges[j].cclass;
-			if (cc) {
-				nintervals += cc->nintervals;
+			if (!cc || !cc->nintervals)
+				continue;
+			if (k == b->heapcap) {
+				b->heapcap = b->heapcap ? 2 * b->heapcap : 64;
+				b->heap = realloc(b->heap,
+					b->heapcap * sizeof *b->heap);
 			}
+			b->heap[k].cc = cc;
+			b->heap[k].pos = 0;
+			k++;
+			nbounds += 2 * cc->nintervals;
 		}
 	}
-
-	if (!nintervals) {
-		/* shortcut empty set */
-		*nbreaks_return = 0;
-		return NULL;
+	if (nbounds > b->breakscap) {
+		b->breakscap = nbounds;
+		b->breaks = realloc(b->breaks,
+			b->breakscap * sizeof *b->breaks);
+	}
+	for (j = k / 2; j-- > 0; )
+		heap_sift_down(b->heap, k, j);
+
+	/* Repeatedly take the least bound, skipping duplicates */
+	while (k) {
+		struct bounds_cursor *top = &b->heap[0];
+		unsigned v = cursor_bound(top);
+
+		if (!nbreaks || b->breaks[nbreaks - 1] != v)
+			b->breaks[nbreaks++] = v;
+		if (++top->pos == 2 * top->cc->nintervals)
+			*top = b->heap[--k];
+		if (k)
+			heap_sift_down(b->heap, k, 0);
 	}
 
-	/* Build the non-normalized set of cclass breaks
-	 * by just collecting all lo and hi values */
-	unsigned *breaks = malloc(nintervals * 2 * sizeof (unsigned));
-	unsigned nbreaks = 0;
-	bitset_for(ni, nodes) {
-		const struct node *n = &nfa->nodes[ni];
+	*nbreaks_return = nbreaks;
+	return b->breaks;
+}
+
+/* Partition class number for characters that are on no edge */
+#define NOCLASS (~0u)
+
+/*
+ * The alphabet partition of a graph.
+ * The characters are divided into classes such that every edge either
+ * wholly contains or wholly excludes each class.  Each class is a set
+ * of elementary intervals (the intervals between adjacent edge bounds)
+ * that lie on exactly the same edges, and each edge's cclass is
+ * recorded as the bitset of classes it contains.  Membership and
+ * union of the edges' cclasses then become bitset operations.
+ */
+struct partition {
+	unsigned nclasses;
+	unsigned nelem;		/* number of elementary intervals */
+	unsigned *bound;	/* elementary interval e is [bound[e],bound[e+1]) */
+	unsigned *elemclass;	/* class of each elementary interval, or NOCLASS */
+	unsigned *firstelem;	/* the first elementary interval of each class */
+	unsigned *nextelem;	/* the next interval of the same class, or NOCLASS */
+	unsigned nedges;
+	unsigned *edgebase;	/* index of node i's first edge into edgeclasses[] */
+	bitset **edgeclasses;	/* the classes of each edge, or NULL for epsilon */
+};
+
+/* Returns the classes of edge j of node i */
+static inline const bitset *
+partition_edge(const struct partition *p, unsigned i, unsigned j)
+{
+	return p->edgeclasses[p->edgebase[i] + j];
+}
+
+/*
+ * Partitions the alphabet of a graph into classes.
+ * The elementary intervals come from merging the bounds of all the
+ * edges' cclasses; intervals with equal sets of edges share a class.
+ */
+static void
+partition_init(struct partition *p, const struct nfa *nfa)
+{
+	struct breaks b = { 0, 0, 0, 0 };
+	bitset *all = bitset_new(nfa->nnodes);
+	unsigned nedges, nbounds, i, j, k, e, h, hashsz;
+	unsigned *hash, *lastelem;
+	bitset **sig;
+
+	/* Number the edges */
+	p->edgebase = malloc((nfa->nnodes + 1) * sizeof *p->edgebase);
+	for (nedges = i = 0; i < nfa->nnodes; ++i) {
+		p->edgebase[i] = nedges;
+		nedges += nfa->nodes[i].nedges;
+		bitset_insert(all, i);
+	}
+	p->edgebase[i] = nedges;
+	p->nedges = nedges;
+
+	/* Find the elementary intervals */
+	cclass_breaks(nfa, all, &b, &nbounds);
+	bitset_free(all);
+	free(b.heap);
+	p->bound = b.breaks;
+	p->nelem = nbounds ? nbounds - 1 : 0;
+
+	/* Find the signature of each elementary interval: the set
+	 * of edges that contain it */
+	sig = malloc(p->nelem * sizeof *sig);
+	for (e = 0; e < p->nelem; ++e)
+		sig[e] = bitset_new(nedges);
+	for (i = 0; i < nfa->nnodes; ++i) {
+		const struct node *n = &nfa->nodes[i];
 		for (j = 0; j < n->nedges; ++j) {
 			const cclass *cc = n->edges[j].cclass;
-			if (cc) {
-				for (i = 0; i < cc->nintervals; ++i) {
-					breaks[nbreaks++] = cc->interval[i].lo;
-					breaks[nbreaks++] = cc->interval[i].hi;
-				}
+			if (!cc)
+				continue;
+			for (k = 0, e = 0; k < cc->nintervals; ++k) {
+				while (p->bound[e] < cc->interval[k].lo)
+					e++;
+				for (; p->bound[e] < cc->interval[k].hi; ++e)
+					bitset_insert(sig[e],
+						      p->edgebase[i] + j);
 			}
 		}
 	}
 
-	/* Sort the array of breaks */
-	qsort(breaks, nbreaks, sizeof *breaks, unsigned_cmp);
-
-	/* Remove duplicates */
-	unsigned lastbreak = breaks[0];
-	unsigned newlen = 1;
-	for (i = 1; i < nbreaks; ++i) {
-		if (breaks[i] != lastbreak) {
-			lastbreak = breaks[newlen++] = breaks[i];
+	/* Give equal signatures the same class, in order of their
+	 * first interval */
+	for (hashsz = 16; hashsz < 2 * p->nelem; hashsz *= 2)
+		;
+	hash = malloc(hashsz * sizeof *hash);
+	for (h = 0; h < hashsz; ++h)
+		hash[h] = NOCLASS;
+	p->elemclass = malloc(p->nelem * sizeof *p->elemclass);
+	p->nextelem = malloc(p->nelem * sizeof *p->nextelem);
+	p->firstelem = malloc(p->nelem * sizeof *p->firstelem);
+	lastelem = malloc(p->nelem * sizeof *lastelem);
+	p->nclasses = 0;
+	for (e = 0; e < p->nelem; ++e) {
+		if (bitset_is_empty(sig[e])) {
+			p->elemclass[e] = NOCLASS;
+			continue;
 		}
+		h = bitset_hash(sig[e]);
+		while ((k = hash[h & (hashsz - 1)]) != NOCLASS &&
+		       bitset_cmp(sig[p->firstelem[k]], sig[e]) != 0)
+			h++;
+		if (k == NOCLASS) {
+			k = hash[h & (hashsz - 1)] = p->nclasses++;
+			p->firstelem[k] = e;
+		} else
+			p->nextelem[lastelem[k]] = e;
+		lastelem[k] = e;
+		p->nextelem[e] = NOCLASS;
+		p->elemclass[e] = k;
 	}
-	nbreaks = newlen;
+	free(lastelem);
+	free(hash);
+
+	/* Record the classes of each edge */
+	p->edgeclasses = calloc(nedges, sizeof *p->edgeclasses);
+	for (i = 0; i < nfa->nnodes; ++i)
+		for (j = 0; j < nfa->nodes[i].nedges; ++j)
+			if (nfa->nodes[i].edges[j].cclass)
+				p->edgeclasses[p->edgebase[i] + j] =
+					bitset_new(p->nclasses);
+	for (e = 0; e < p->nelem; ++e) {
+		if (p->elemclass[e] == NOCLASS)
+			continue;
+		bitset_for(k, sig[e])
+			bitset_insert(p->edgeclasses[k], p->elemclass[e]);
+	}
+	for (e = 0; e < p->nelem; ++e)
+		bitset_free(sig[e]);
+	free(sig);
+}
 
-	/* Reduce storage overhead */
-	breaks = realloc(breaks, nbreaks * sizeof *breaks);
+static void
+partition_fini(struct partition *p)
+{
+	unsigned i;
 
-	*nbreaks_return = nbreaks;
-	return breaks;
+	for (i = 0; i < p->nedges; ++i)
+		if (p->edgeclasses[i])
+			bitset_free(p->edgeclasses[i]);
+	free(p->edgeclasses);
+	free(p->bound);
+	free(p->elemclass);
+	free(p->firstelem);
+	free(p->nextelem);
+	free(p->edgebase);
 }
 
 /*
@@ -323,12 +635,22 @@ cclass_breaks(const struct nfa *nfa, const bitset *nodes,
 static void
 make_dfa(struct nfa *dfa, const struct nfa *nfa)
 {
-	struct bitset *bs;
+	struct bitset *bs, *dest, *touched;
 	struct equiv equiv;
+	struct partition part;
+	struct bitset **seen = 0;	/* dests already found from ei */
+	unsigned *seendi = 0;		/* DFA nodes of the seen dests */
+	unsigned nseen, seencap = 0;
+	struct cclass_builder *builder = 0; /* for each edge from ei */
+	unsigned nbuilders = 0;
 	unsigned ei;
 
 	equiv_init(&equiv, nfa);
 
+	/* Partition the alphabet once for the whole graph, rather than
+	 * finding the breaks of the edges of each DFA node */
+	partition_init(&part, nfa);
+
 	/* the initial dfa node is the epislon closure of the nfa's initial */
 	bs = bitset_new(nfa->nnodes);
 	bitset_insert(bs, 0);
@@ -336,82 +658,126 @@ make_dfa(struct nfa *dfa, const struct nfa *nfa)
 	equiv_lookup(dfa, &equiv, bs) /* == 0 */;
 	bitset_free(bs);
 
+	dest = bitset_new(nfa->nnodes);
+	touched = bitset_new(part.nclasses);
+
 	/*
 	 * Iterate ei over the unprocessed DFA nodes.
 	 * Each iteration may add more DFA nodes, but it
 	 * won't add duplicates.
 	 */
 	for (ei = 0; ei < dfa->nnodes; ei++) {
-		const struct node *en = &dfa->nodes[ei];
-		unsigned nbreaks, bi;
-		unsigned *breaks;
+		const struct node *en;
 		struct bitset *src;
+		unsigned ni, j, k;
 
 		/* src is the set of NFA nodes corresponding to
 		 * the current DFA node ei */
 		src = equiv_get(&equiv, ei);
 
-		/* We want to combine all the edge cclasses
-		 * of src together, and then efficiently walk over
-		 * their members.
-		 * The breaks list speeds this up because if
-		 * characters c1,c2 appear adjacent in the breaks list,
-		 * then we can reason that for any cclass in any src
-		 * edges, either:
-		 *   [c1,c2) is wholly within that cclass
-		 *   [c1,c2) is wholly outside that cclass
-		 */
-		breaks = cclass_breaks(nfa, src, &nbreaks);
-		for (bi = 1; bi < nbreaks; ++bi) {
-			const unsigned lo = breaks[bi - 1];
-			const unsigned hi = breaks[bi];
-			unsigned ni, di, j;
+		/* Find the classes of characters on any edge from src.
+		 * Every edge either wholly contains or wholly excludes
+		 * each class, so each class leads to one DFA node. */
+		bitset_clear(touched);
+		bitset_for(ni, src)
+			for (j = 0; j < nfa->nodes[ni].nedges; ++j)
+				if (nfa->nodes[ni].edges[j].cclass)
+					bitset_or_with(touched,
+						partition_edge(&part, ni, j));
+
+		nseen = 0;
+		bitset_for(k, touched) {
+			unsigned di, e, si;
 
 			/* Find the set of NFA states, dest, to which
-			 * the cclass [lo,hi) edges to from the
-			 * src set. We can do this by just checking for
-			 * membership of lo. */
-			bitset *dest = bitset_alloca(nfa->nnodes);
+			 * the class k edges to from the src set */
+			bitset_clear(dest);
 			bitset_for(ni, src) {
 			    const struct node *n = &nfa->nodes[ni];
 			    for (j = 0; j < n->nedges; ++j) {
 				if (n->edges[j].cclass &&
-				    cclass_contains_ch(n->edges[j].cclass, lo))
+				    bitset_contains(
+					partition_edge(&part, ni, j), k))
 				{
 				    bitset_insert(dest, n->edges[j].dest);
 				}
 			    }
 			}
-			/* Expand the resulting dest set to its
-			 * epsilon closure */
-			epsilon_closure(nfa, dest);
 
-			/* Find or make di, the DFA equivalent
-			 * node for {dest} */
-			di = equiv_lookup(dfa, &equiv, dest);
+			/* Classes often share their dest; reuse its
+			 * DFA node rather than look it up again */
+			for (si = 0; si < nseen; ++si)
+				if (bitset_cmp(seen[si], dest) == 0)
+					break;
+			if (si < nseen) {
+				di = seendi[si];
+			} else {
+				if (nseen == seencap) {
+					seencap = seencap ? 2 * seencap : 16;
+					seen = realloc(seen,
+						seencap * sizeof *seen);
+					seendi = realloc(seendi,
+						seencap * sizeof *seendi);
+					for (si = nseen; si < seencap; ++si)
+						seen[si] = bitset_new(
+							nfa->nnodes);
+				}
+				bitset_copy(seen[nseen], dest);
+
+				/* Expand the resulting dest set to its
+				 * epsilon closure */
+				epsilon_closure(nfa, dest);
+
+				/* Find or make di, the DFA equivalent
+				 * node for {dest} */
+				di = equiv_lookup(dfa, &equiv, dest);
+				seendi[nseen++] = di;
+			}
 
 			/* (Recompute pointers here because nodes may have
 			 *  been realloced) */
 			en = &dfa->nodes[ei];
 
 			/* Create or find an existing edge from ei->di */
-			struct edge *e = NULL;
-			for (j = 0; j < en->nedges; ++j) {
-				if (en->edges[j].dest == di) {
-					e = &en->edges[j];
+			for (j = 0; j < en->nedges; ++j)
+				if (en->edges[j].dest == di)
 					break;
+			if (j == en->nedges) {
+				nfa_new_edge(dfa, ei, di);
+				if (j == nbuilders) {
+					nbuilders = nbuilders ? 2 * nbuilders
+							      : 16;
+					builder = realloc(builder,
+					    nbuilders * sizeof *builder);
+					for (e = j; e < nbuilders; ++e)
+					    cclass_builder_init(&builder[e]);
 				}
 			}
-			if (!e) {
-				e = nfa_new_edge(dfa, ei, di);
-				e->cclass = cclass_new();
-			}
 
-			/* Add the edge along [lo,hi) into the DFA */
-			cclass_add(e->cclass, lo, hi);
+			/* Collect the class's intervals for the edge */
+			for (e = part.firstelem[k]; e != NOCLASS;
+			     e = part.nextelem[e])
+				cclass_builder_add(&builder[j], part.bound[e],
+						   part.bound[e + 1]);
 		}
-		free(breaks);
+
+		/* Construct the edges' cclasses, and share them */
+		en = &dfa->nodes[ei];
+		for (j = 0; j < en->nedges; ++j)
+			en->edges[j].cclass = cclass_intern(
+				cclass_builder_finish(&builder[j]));
 	}
+	for (ei = 0; ei < nbuilders; ++ei)
+		cclass_builder_fini(&builder[ei]);
+	free(builder);
+
+	for (ei = 0; ei < seencap; ++ei)
+		bitset_free(seen[ei]);
+	free(seen);
+	free(seendi);
+	bitset_free(touched);
+	bitset_free(dest);
+	partition_fini(&part);
 
 	/* TODO: remove duplicate states */
 
@@ -429,4 +795,5 @@ nfa_to_dfa(struct nfa *nfa)
 	make_dfa(nfa, &copy);
 	/* now nfa actually contains a dfa! */
 	nfa_fini(&copy);
+	nfa_freeze(nfa);
 }
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include "cclass.h"
 
+struct bitset;
+
 /**
  * A (non-)deterministic finite automaton.
  * This is a graph structure that can be used for an NFA or DFA.
@@ -18,15 +20,20 @@
  * A weaker guarantee is that the 'finals' set for a node
  * has at most one member. Or, at least, its first member
  * is the most important.
+ *
+ * A graph under construction holds each node's edges and finals
+ * in separately allocated arrays. Once complete, it can be frozen
+ * by #nfa_freeze() so that they share one contiguous pool.
  */
 struct nfa {
+	void *pool;		/* the frozen edges and finals, or NULL */
 	unsigned nnodes;
 	struct node {
 		unsigned nfinals;
 		const void **finals;
 		unsigned nedges;
 		struct edge {
-			cclass *cclass;
+			cclass *cclass;	/* released by nfa_fini() */
 			unsigned dest;
 		} *edges;
 	} *nodes;
@@ -98,9 +105,30 @@ void		nfa_add_final(struct nfa *nfa, unsigned n, const void *final);
  */
 struct edge *nfa_new_edge(struct nfa *nfa, unsigned from, unsigned to);
 
+/**
+ * Compacts a graph into contiguous storage: all the nodes' edges,
+ * in node order, followed by all the nodes' finals.
+ * The graph remains valid. Adding to a frozen graph first copies
+ * it back into separately allocated arrays.
+ *
+ * @param nfa   the graph to freeze
+ */
+void nfa_freeze(struct nfa *nfa);
+
+/**
+ * Expands a set of nodes to its epsilon closure; that is, inserts all
+ * the nodes reachable through zero or more epsilon edges.
+ *
+ * @param nfa  the graph with the epsilon edges
+ * @param s    the set of node indicies to expand
+ */
+void epsilon_closure(const struct nfa *nfa, struct bitset *s);
+
 /**
  * Converts a non-deterministic graph into a deterministic one.
  * The conversion is performed in-place.
+ * The resulting edges have interned cclasses (see #cclass_intern()),
+ * and the result is frozen (see #nfa_freeze()).
  *
  * @param nfa   the graph to make deterministic.
  */
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "str.h"
+#include "match.h"
+#include "strgen.h"
+
+/* Unit tests for the string set generator */
+
+/**
+ * Generates the strings after a prefix, and describes them in a
+ * buffer, separated by spaces. Deferred strings are followed by "...".
+ *
+ * @returns the buffer
+ */
+static const char *
+generated(struct strgen *strgen, const char *prefix)
+{
+	static char buf[1024];
+	struct match *list, *m, **tail;
+	STR p = str_new(prefix);
+	char *b = buf;
+
+	tail = strgen_generator.generate(&list, p, strgen);
+	*tail = 0;
+	*b = '\0';
+	while ((m = list)) {
+		list = m->next;
+		if (b != buf)
+			*b++ = ' ';
+		b += str_copy(m->str, b, 0, str_len(m->str));
+		if (m->flags & MATCH_DEFERRED)
+			b += sprintf(b, "...");
+		*b = '\0';
+		match_free(m);
+	}
+	return buf;
+}
+
+static void
+add(struct strgen *strgen, const char *s)
+{
+	STR ss = str_new(s);
+	strgen_add(strgen, ss);
+}
+
+int
+main()
+{
+	{
+		struct strgen *strgen = strgen_new();
+
+		assert(strcmp(generated(strgen, ""), "") == 0);
+		add(strgen, "b/x@UP");
+		add(strgen, "a");
+		add(strgen, "b/y/z");
+		add(strgen, "a/1");
+		add(strgen, "b/x@UP");	/* duplicate */
+		add(strgen, "ab");
+		add(strgen, "b/");
+
+		assert(strcmp(generated(strgen, ""), "a a/... ab b/...") == 0);
+		assert(strcmp(generated(strgen, "a/"), "1") == 0);
+		assert(strcmp(generated(strgen, "b/"), "x@UP y/...") == 0);
+		assert(strcmp(generated(strgen, "b/y/"), "z") == 0);
+		assert(strcmp(generated(strgen, "c/"), "") == 0);
+
+		/* Strings added after generating are sorted in */
+		add(strgen, "a/0");
+		add(strgen, "a/1");
+		assert(strcmp(generated(strgen, "a/"), "0 1") == 0);
+		strgen_generator.free(strgen);
+	}
+	return 0;
+}
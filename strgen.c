@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "str.h"
+#include "vector.h"
+#include "match.h"
+#include "strgen.h"
+
+/* A string in the set, flattened */
+struct strgen_entry {
+	unsigned len;
+	char *data;
+};
+
+/* The set is sorted by content when sealed, so that strings
+ * sharing a prefix are adjacent. Strings added after that are
+ * appended, and sorted in with the rest at the next seal. */
+struct strgen {
+	VECTOR_OF(struct strgen_entry) entries;
+	unsigned sealed;	/* number of entries sorted and unique */
+};
+
+struct strgen *
+strgen_new()
+{
+	return calloc(1, sizeof (struct strgen));
+}
+
+void
+strgen_free(struct strgen *strgen)
+{
+	struct strgen_entry *e;
+
+	if (!strgen)
+		return;
+	vector_for(e, strgen->entries)
+		free(e->data);
+	vector_free(&strgen->entries);
+	free(strgen);
+}
+
+/* Compares an entry against data, as memcmp() would */
+static int
+entry_cmp(const struct strgen_entry *e, const char *data, unsigned len)
+{
+	int cmp = memcmp(e->data, data, e->len < len ? e->len : len);
+
+	if (cmp)
+		return cmp;
+	return e->len < len ? -1 : e->len > len;
+}
+
+/* Finds the index of the first entry not less than data */
+static unsigned
+lower_bound(const struct strgen *strgen, const char *data, unsigned len)
+{
+	unsigned lo = 0, hi = strgen->entries.len;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (entry_cmp(&vector_at(strgen->entries, mid), data, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Tests if an entry starts with data */
+static int
+entry_has_prefix(const struct strgen_entry *e, const char *data, unsigned len)
+{
+	return e->len >= len && memcmp(e->data, data, len) == 0;
+}
+
+void
+strgen_add(struct strgen *strgen, const str *s)
+{
+	struct strgen_entry e;
+
+	e.len = str_len(s);
+	e.data = malloc(e.len ? e.len : 1);
+	str_copy(s, e.data, 0, e.len);
+	vector_append(strgen->entries, e);
+}
+
+/* Orders entries by content, for qsort() */
+static int
+entry_order(const struct strgen_entry *a, const struct strgen_entry *b)
+{
+	return entry_cmp(a, b->data, b->len);
+}
+
+void
+strgen_seal(struct strgen *strgen)
+{
+	struct strgen_entry *e, *last = 0;
+	unsigned n = 0;
+
+	if (strgen->sealed == strgen->entries.len)
+		return;
+	vector_qsort(strgen->entries, entry_order);
+	vector_for(e, strgen->entries) {
+		if (last && entry_order(e, last) == 0) {
+			free(e->data);
+			continue;
+		}
+		last = &vector_at(strgen->entries, n++);
+		*last = *e;
+	}
+	strgen->entries.len = strgen->sealed = n;
+}
+
+/*
+ * Generates the next path component of each string in the set that
+ * starts with the prefix. A component followed by / is deferred.
+ */
+static struct match **
+strgen_generate(struct match **mp, const str *prefix, void *gcontext)
+{
+	struct strgen *strgen = gcontext;
+	unsigned plen = str_len(prefix);
+	char sbuf[256], *p;
+	unsigned i;
+
+	strgen_seal(strgen);
+	p = plen > sizeof sbuf ? malloc(plen) : sbuf;
+	str_copy(prefix, p, 0, plen);
+	i = lower_bound(strgen, p, plen);
+	while (i < strgen->entries.len &&
+	       entry_has_prefix(&vector_at(strgen->entries, i), p, plen))
+	{
+		const struct strgen_entry *e = &vector_at(strgen->entries, i);
+		const char *rest = e->data + plen;
+		const char *slash = memchr(rest, '/', e->len - plen);
+		struct match *m;
+
+		if (e->len == plen) {
+			/* The prefix itself */
+			i++;
+			continue;
+		}
+		if (slash) {
+			/* One deferred for all the strings under it */
+			unsigned complen = slash + 1 - e->data;
+
+			m = match_new(str_newn(rest, complen - plen));
+			m->flags |= MATCH_DEFERRED;
+			while (i < strgen->entries.len &&
+			       entry_has_prefix(&vector_at(strgen->entries, i),
+						e->data, complen))
+				i++;
+		} else {
+			m = match_new(str_newn(rest, e->len - plen));
+			i++;
+		}
+		*mp = m;
+		mp = &m->next;
+	}
+	if (p != sbuf)
+		free(p);
+	return mp;
+}
+
+static void
+strgen_generator_free(void *gcontext)
+{
+	strgen_free(gcontext);
+}
+
+const struct generator strgen_generator = {
+	.generate = strgen_generate,
+	.free = strgen_generator_free,
+};
@@ -0,0 +1,56 @@
+#ifndef strgen_h
+#define strgen_h
+
+struct str;
+struct generator;
+
+/*
+ * A string set generator provides the strings of an in-memory set,
+ * such as the dependency strings of the active goals, to a #matcher.
+ * Like the filesystem, the set is presented one path component at a
+ * time: a string a/b/c is generated as the deferred a/, which expands
+ * to the deferred b/, which expands to c.
+ */
+struct strgen;
+
+/**
+ * Allocates a new, empty string set.
+ * @returns a set to be released with #strgen_free()
+ */
+struct strgen *strgen_new(void);
+
+/**
+ * Adds a string to the set. Adding a string already in the set
+ * has no effect. The string is appended, and only sorted into the set
+ * when the set is sealed, so that adding n strings costs O(n log n).
+ *
+ * @param strgen  the string set
+ * @param s       the string to add (copied)
+ */
+void strgen_add(struct strgen *strgen, const struct str *s);
+
+/**
+ * Sorts the strings added into the set, and drops the duplicates.
+ * The generator does this before it generates, when strings have been
+ * added since; it need only be called before the generator is used
+ * from several threads.
+ *
+ * @param strgen  the string set
+ */
+void strgen_seal(struct strgen *strgen);
+
+/**
+ * Releases a string set.
+ * @param strgen  the string set, or @c NULL
+ */
+void strgen_free(struct strgen *strgen);
+
+/**
+ * The generator for a string set, whose context is the
+ * #strgen. Its free function calls #strgen_free().
+ * It may be called from several threads at once if the set is sealed
+ * with #strgen_seal(), and no strings are added meanwhile.
+ */
+extern const struct generator strgen_generator;
+
+#endif /* strgen_h */
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "str.h"
+#include "globs.h"
+#include "match.h"
+#include "strgen.h"
+#include "uniongen.h"
+
+/* Unit tests for the union generator */
+
+/* Counts the calls to each member generator, by prefix */
+struct counted {
+	struct strgen *strgen;
+	unsigned ncalls;
+	char calls[256];	/* the prefixes, space-separated */
+};
+
+static struct match **
+counted_generate(struct match **mp, const str *prefix, void *gcontext)
+{
+	struct counted *c = gcontext;
+	char *b = c->calls + strlen(c->calls);
+
+	c->ncalls++;
+	b += str_copy(prefix, b, 0, str_len(prefix));
+	strcpy(b, " ");
+	return strgen_generator.generate(mp, prefix, c->strgen);
+}
+
+static void
+counted_free(void *gcontext)
+{
+	struct counted *c = gcontext;
+
+	strgen_free(c->strgen);
+	c->strgen = 0;
+}
+
+static const struct generator counted_generator = {
+	.generate = counted_generate,
+	.free = counted_free,
+};
+
+static void
+add(struct strgen *strgen, const char *s)
+{
+	STR ss = str_new(s);
+	strgen_add(strgen, ss);
+}
+
+/**
+ * Matches a glob over a generator, and describes the results in a
+ * buffer, separated by spaces, in order.
+ *
+ * @returns the buffer
+ */
+static const char *
+matched(const char *glob, const struct generator *generator, void *gcontext,
+	unsigned nthreads)
+{
+	static char buf[8192];
+	struct globs *globs = globs_new();
+	struct matcher *matcher;
+	STR g = str_new(glob);
+	char *b = buf;
+	str *s;
+
+	globs_add(globs, g, glob);
+	globs_compile(globs);
+	matcher = matcher_new(globs, generator, gcontext);
+	matcher_set_threads(matcher, nthreads);
+	*b = '\0';
+	while ((s = matcher_next(matcher, 0))) {
+		if (b != buf)
+			*b++ = ' ';
+		b += str_copy(s, b, 0, str_len(s));
+		*b = '\0';
+		str_free(s);
+	}
+	matcher_free(matcher);
+	globs_free(globs);
+	return buf;
+}
+
+int
+main()
+{
+	{
+		/* Overlapping members are merged without duplicates,
+		 * and each shared directory is expanded once */
+		struct counted fs = { strgen_new() }, goals = { strgen_new() };
+		struct uniongen *u = uniongen_new();
+
+		add(fs.strgen, "src/a.c");
+		add(fs.strgen, "src/b.c");
+		add(fs.strgen, "Makefile");
+		add(goals.strgen, "src/b.c");
+		add(goals.strgen, "src/c.c");
+		add(goals.strgen, "out/a.o");
+		uniongen_add(u, &counted_generator, &fs);
+		uniongen_add(u, &counted_generator, &goals);
+
+		assert(strcmp(matched("s*/*.c", &uniongen_generator, u, 0),
+			      "src/a.c src/b.c src/c.c") == 0);
+		/* "" and src/ expanded once each; out/ is never
+		 * expanded as no glob can match within it */
+		assert(fs.ncalls == 2 && goals.ncalls == 2);
+		assert(strcmp(fs.calls, " src/ ") == 0);
+		assert(!fs.strgen && !goals.strgen);	/* freed */
+	}
+	{
+		/* Deferred and undeferred strings are kept apart */
+		struct strgen *a = strgen_new(), *b = strgen_new();
+		struct uniongen *u = uniongen_new();
+
+		add(a, "x");
+		add(b, "x/y");
+		add(b, "x");
+		uniongen_add(u, &strgen_generator, a);
+		uniongen_add(u, &strgen_generator, b);
+		assert(strcmp(matched("x*", &uniongen_generator, u, 0),
+			      "x") == 0);
+
+		b = strgen_new();
+		add(b, "x/y");
+		add(b, "x");
+		u = uniongen_new();
+		uniongen_add(u, &strgen_generator, b);
+		assert(strcmp(matched("*/*", &uniongen_generator, u, 0),
+			      "x/y") == 0);
+	}
+	{
+		/* With worker threads */
+		struct strgen *a = strgen_new(), *b = strgen_new();
+		struct uniongen *u = uniongen_new();
+		char s[32];
+		unsigned i, j, n;
+		const char *result;
+
+		for (i = 0; i < 20; i++)
+			for (j = 0; j < 20; j++) {
+				snprintf(s, sizeof s, "d%u/e%u/f", i, j);
+				add((i + j) & 1 ? a : b, s);
+				add(a, s);
+			}
+		strgen_seal(a);
+		strgen_seal(b);
+		uniongen_add(u, &strgen_generator, a);
+		uniongen_add(u, &strgen_generator, b);
+		result = matched("*/*/f", &uniongen_generator, u, 4);
+		for (n = 1; *result; result++)
+			n += *result == ' ';
+		assert(n == 400);
+	}
+	return 0;
+}
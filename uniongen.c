@@ -0,0 +1,103 @@
+#include <stdlib.h>
+
+#include "str.h"
+#include "vector.h"
+#include "match.h"
+#include "uniongen.h"
+
+struct uniongen_member {
+	const struct generator *generator;
+	void *gcontext;
+};
+
+struct uniongen {
+	VECTOR_OF(struct uniongen_member) members;
+};
+
+struct uniongen *
+uniongen_new()
+{
+	return calloc(1, sizeof (struct uniongen));
+}
+
+void
+uniongen_add(struct uniongen *uniongen,
+	     const struct generator *generator, void *gcontext)
+{
+	struct uniongen_member member = { generator, gcontext };
+
+	vector_append(uniongen->members, member);
+}
+
+void
+uniongen_free(struct uniongen *uniongen)
+{
+	struct uniongen_member *member;
+
+	if (!uniongen)
+		return;
+	vector_for(member, uniongen->members)
+		if (member->generator->free)
+			member->generator->free(member->gcontext);
+	vector_free(&uniongen->members);
+	free(uniongen);
+}
+
+/* Orders matches by string, then deferred after undeferred */
+static int
+match_cmp(struct match * const *a, struct match * const *b)
+{
+	int cmp = str_cmp((*a)->str, (*b)->str);
+
+	if (cmp)
+		return cmp;
+	return ((*a)->flags & MATCH_DEFERRED) - ((*b)->flags & MATCH_DEFERRED);
+}
+
+/*
+ * Collects the strings that each member generates from the prefix,
+ * sorts them, and releases the duplicates.
+ */
+static struct match **
+uniongen_generate(struct match **mp, const str *prefix, void *gcontext)
+{
+	const struct uniongen *uniongen = gcontext;
+	const struct uniongen_member *member;
+	AUTO_VECTOR_OF(struct match *, sorted);
+	struct match *list, **tail = &list, *m, *last, **mm;
+
+	vector_for(member, uniongen->members)
+		tail = member->generator->generate(tail, prefix,
+						   member->gcontext);
+	*tail = 0;
+	if (!list)
+		return mp;
+	if (uniongen->members.len > 1) {
+		for (m = list; m; m = m->next)
+			vector_append(sorted, m);
+		vector_qsort(sorted, match_cmp);
+		last = 0;
+		tail = &list;
+		vector_for(mm, sorted) {
+			if (last && match_cmp(mm, &last) == 0) {
+				match_free(*mm);
+				continue;
+			}
+			last = *tail = *mm;
+			tail = &last->next;
+		}
+	}
+	*mp = list;
+	return tail;
+}
+
+static void
+uniongen_generator_free(void *gcontext)
+{
+	uniongen_free(gcontext);
+}
+
+const struct generator uniongen_generator = {
+	.generate = uniongen_generate,
+	.free = uniongen_generator_free,
+};
@@ -0,0 +1,46 @@
+#ifndef uniongen_h
+#define uniongen_h
+
+struct generator;
+
+/*
+ * A union generator merges the strings of several generators, such as
+ * the filesystem and the goal strings, into one match environment.
+ * Each prefix is given to every member generator, and the strings
+ * they generate are merged in order with duplicates removed. So a
+ * directory that more than one member generates is deferred once,
+ * and the matcher steps through it once, for all of them.
+ */
+struct uniongen;
+
+/**
+ * Allocates a new union generator, with no members.
+ * @returns a union to be released with #uniongen_free()
+ */
+struct uniongen *uniongen_new(void);
+
+/**
+ * Adds a member generator to the union. The union takes ownership
+ * of the context, and releases it with the generator's free function.
+ *
+ * @param uniongen   the union
+ * @param generator  the member generator
+ * @param gcontext   the context for the member generator
+ */
+void uniongen_add(struct uniongen *uniongen,
+		  const struct generator *generator, void *gcontext);
+
+/**
+ * Releases a union generator and its members' contexts.
+ * @param uniongen  the union, or @c NULL
+ */
+void uniongen_free(struct uniongen *uniongen);
+
+/**
+ * The generator for a union, whose context is the #uniongen.
+ * Its free function calls #uniongen_free().
+ * It may be called from several threads at once if its members may.
+ */
+extern const struct generator uniongen_generator;
+
+#endif /* uniongen_h */